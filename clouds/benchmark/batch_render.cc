@@ -0,0 +1,553 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host tool rendering batches of jobs through the granular processor, on all
+// cores. Each job is a line of a job list:
+//
+//   input.wav script.txt mode quality output.wav
+//
+// - input.wav is a 16-bit PCM file, mono or stereo, at any sample rate; or
+//   sine:frequency:duration for a synthetic input.
+// - script.txt contains lines of the form "time parameter value", applied at
+//   the first block starting at or after time (in seconds); or - for the
+//   default parameters.
+// - mode is granular, stretch, looping or spectral; quality is 0 to 3.
+// - output.wav is written as 16-bit stereo at the input sample rate; or - to
+//   discard the output.
+//
+// The jobs are distributed on a work-stealing pool of threads, each owning
+// its processor and its buffers, reused from one job to the next.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif  // __x86_64__ || __i386__
+
+#include "clouds/dsp/granular_processor.h"
+#include "stmlib/utils/random.h"
+
+using namespace clouds;
+using namespace std;
+
+const size_t kRenderSize = 32;
+
+struct Event {
+  float time;
+  string parameter;
+  float value;
+};
+
+struct Job {
+  string input;
+  string script;
+  PlaybackMode mode;
+  int32_t quality;
+  string output;
+  
+  // Filled by the worker.
+  bool ok;
+  string error;
+  size_t num_frames;
+  double duration;
+  double elapsed;
+  int32_t worker;
+};
+
+// Audio read from a file or synthesized, as interleaved stereo floats.
+struct Audio {
+  vector<float> samples;
+  size_t num_frames;
+  uint32_t sample_rate;
+};
+
+bool ReadWav(const string& file_name, Audio* audio, string* error) {
+  FILE* fp = fopen(file_name.c_str(), "rb");
+  if (!fp) {
+    *error = "cannot open " + file_name;
+    return false;
+  }
+  char riff[12];
+  if (fread(riff, 1, 12, fp) != 12 || memcmp(riff, "RIFF", 4) ||
+      memcmp(riff + 8, "WAVE", 4)) {
+    fclose(fp);
+    *error = file_name + " is not a WAV file";
+    return false;
+  }
+  uint16_t format = 0;
+  uint16_t num_channels = 0;
+  uint16_t bits = 0;
+  audio->sample_rate = 0;
+  while (true) {
+    char id[4];
+    uint32_t size;
+    if (fread(id, 1, 4, fp) != 4 || fread(&size, 4, 1, fp) != 1) {
+      fclose(fp);
+      *error = file_name + " has no data chunk";
+      return false;
+    }
+    if (!memcmp(id, "fmt ", 4)) {
+      uint8_t fmt[16];
+      if (size < 16 || fread(fmt, 1, 16, fp) != 16) {
+        break;
+      }
+      memcpy(&format, &fmt[0], 2);
+      memcpy(&num_channels, &fmt[2], 2);
+      memcpy(&audio->sample_rate, &fmt[4], 4);
+      memcpy(&bits, &fmt[14], 2);
+      fseek(fp, size - 16 + (size & 1), SEEK_CUR);
+    } else if (!memcmp(id, "data", 4)) {
+      if (format != 1 || bits != 16 || num_channels < 1 ||
+          num_channels > 2) {
+        break;
+      }
+      vector<int16_t> pcm(size / 2);
+      size_t read = fread(&pcm[0], 2, pcm.size(), fp);
+      fclose(fp);
+      audio->num_frames = read / num_channels;
+      audio->samples.resize(audio->num_frames * 2);
+      for (size_t i = 0; i < audio->num_frames; ++i) {
+        int16_t l = pcm[i * num_channels];
+        int16_t r = pcm[i * num_channels + num_channels - 1];
+        audio->samples[2 * i] = l / 32768.0f;
+        audio->samples[2 * i + 1] = r / 32768.0f;
+      }
+      return true;
+    } else {
+      fseek(fp, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fclose(fp);
+  *error = file_name + " is not a 16-bit PCM mono or stereo file";
+  return false;
+}
+
+bool ReadInput(const string& input, Audio* audio, string* error) {
+  float frequency;
+  float duration;
+  if (sscanf(input.c_str(), "sine:%f:%f", &frequency, &duration) == 2) {
+    audio->sample_rate = kNativeSampleRate;
+    audio->num_frames = static_cast<size_t>(duration * audio->sample_rate);
+    audio->samples.resize(audio->num_frames * 2);
+    float phase = 0.0f;
+    for (size_t i = 0; i < audio->num_frames; ++i) {
+      phase += frequency / audio->sample_rate;
+      if (phase >= 1.0f) {
+        phase -= 1.0f;
+      }
+      float x = 0.5f * sinf(phase * 2.0f * M_PI);
+      audio->samples[2 * i] = audio->samples[2 * i + 1] = x;
+    }
+    return true;
+  }
+  return ReadWav(input, audio, error);
+}
+
+bool ReadScript(const string& file_name, vector<Event>* events, string* error) {
+  events->clear();
+  if (file_name == "-") {
+    return true;
+  }
+  FILE* fp = fopen(file_name.c_str(), "r");
+  if (!fp) {
+    *error = "cannot open " + file_name;
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    Event e;
+    char parameter[64];
+    if (line[0] == '#' ||
+        sscanf(line, "%f %63s %f", &e.time, parameter, &e.value) != 3) {
+      continue;
+    }
+    e.parameter = parameter;
+    events->push_back(e);
+  }
+  fclose(fp);
+  stable_sort(
+      events->begin(), events->end(),
+      [](const Event& a, const Event& b) { return a.time < b.time; });
+  return true;
+}
+
+void InitParameters(Parameters* p) {
+  p->position = 0.5f;
+  p->size = 0.5f;
+  p->pitch = 0.0f;
+  p->density = 0.5f;
+  p->texture = 0.5f;
+  p->dry_wet = 1.0f;
+  p->stereo_spread = 0.0f;
+  p->feedback = 0.0f;
+  p->reverb = 0.0f;
+  p->freeze = false;
+  p->trigger = false;
+  p->gate = false;
+}
+
+bool SetParameter(Parameters* p, const Event& e) {
+  struct { const char* name; float* value; } floats[] = {
+    { "position", &p->position },
+    { "size", &p->size },
+    { "pitch", &p->pitch },
+    { "density", &p->density },
+    { "texture", &p->texture },
+    { "dry_wet", &p->dry_wet },
+    { "stereo_spread", &p->stereo_spread },
+    { "feedback", &p->feedback },
+    { "reverb", &p->reverb },
+  };
+  for (size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); ++i) {
+    if (e.parameter == floats[i].name) {
+      *floats[i].value = e.value;
+      return true;
+    }
+  }
+  struct { const char* name; bool* value; } bools[] = {
+    { "freeze", &p->freeze },
+    { "trigger", &p->trigger },
+    { "gate", &p->gate },
+  };
+  for (size_t i = 0; i < sizeof(bools) / sizeof(bools[0]); ++i) {
+    if (e.parameter == bools[i].name) {
+      *bools[i].value = e.value != 0.0f;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WriteWavHeader(FILE* fp, uint32_t num_frames, uint32_t sample_rate) {
+  uint32_t l;
+  uint16_t s;
+  fwrite("RIFF", 4, 1, fp);
+  l = 36 + num_frames * 4;
+  fwrite(&l, 4, 1, fp);
+  fwrite("WAVE", 4, 1, fp);
+  fwrite("fmt ", 4, 1, fp);
+  l = 16;
+  fwrite(&l, 4, 1, fp);
+  s = 1;
+  fwrite(&s, 2, 1, fp);
+  s = 2;
+  fwrite(&s, 2, 1, fp);
+  fwrite(&sample_rate, 4, 1, fp);
+  l = sample_rate * 4;
+  fwrite(&l, 4, 1, fp);
+  s = 4;
+  fwrite(&s, 2, 1, fp);
+  s = 16;
+  fwrite(&s, 2, 1, fp);
+  fwrite("data", 4, 1, fp);
+  l = num_frames * 4;
+  fwrite(&l, 4, 1, fp);
+}
+
+// The processor and buffers of one thread, reused from one job to the next.
+class Worker {
+ public:
+  Worker() {
+    large_buffer_.resize(kLargeBufferSize);
+    small_buffer_.resize(kSmallBufferSize);
+    processor_ = new GranularProcessor;
+  }
+  
+  ~Worker() {
+    delete processor_;
+  }
+  
+  void Render(Job* job) {
+    chrono::high_resolution_clock::time_point start = \
+        chrono::high_resolution_clock::now();
+    job->ok = ReadInput(job->input, &input_, &job->error) &&
+        ReadScript(job->script, &events_, &job->error) &&
+        Process(job);
+    job->num_frames = input_.num_frames;
+    job->duration = static_cast<double>(input_.num_frames) / \
+        input_.sample_rate;
+    job->elapsed = chrono::duration<double>(
+        chrono::high_resolution_clock::now() - start).count();
+  }
+  
+ private:
+  bool Process(Job* job) {
+    size_t num_frames = input_.num_frames;
+    num_frames -= num_frames % kRenderSize;
+    output_.resize(num_frames * 2);
+    pcm_.resize(num_frames * 2);
+    
+    // Some modes read parts of their buffers before writing them; clear them so
+    // that a job renders the same on any worker.
+    fill(large_buffer_.begin(), large_buffer_.end(), 0);
+    fill(small_buffer_.begin(), small_buffer_.end(), 0);
+    processor_->Init(
+        &large_buffer_[0], large_buffer_.size(),
+        &small_buffer_[0], small_buffer_.size(),
+        input_.sample_rate);
+    // Each thread has its own random state, reseeded so that the output of a
+    // job does not depend on the jobs rendered before it.
+    stmlib::Random::Seed(0x21);
+    processor_->set_playback_mode(job->mode);
+    processor_->set_quality(job->quality);
+    Parameters* p = processor_->mutable_parameters();
+    InitParameters(p);
+    processor_->Prepare();
+    
+    size_t next_event = 0;
+    for (size_t n = 0; n < num_frames; n += kRenderSize) {
+      float time = static_cast<float>(n) / input_.sample_rate;
+      while (next_event < events_.size() &&
+             events_[next_event].time <= time) {
+        if (!SetParameter(p, events_[next_event])) {
+          job->error = "unknown parameter " + events_[next_event].parameter;
+          return false;
+        }
+        ++next_event;
+      }
+      processor_->Process(
+          &input_.samples[2 * n], &output_[2 * n], kRenderSize);
+      processor_->Prepare();
+    }
+    
+    if (job->output == "-") {
+      return true;
+    }
+    FILE* fp = fopen(job->output.c_str(), "wb");
+    if (!fp) {
+      job->error = "cannot write " + job->output;
+      return false;
+    }
+    for (size_t i = 0; i < num_frames * 2; ++i) {
+      pcm_[i] = stmlib::Clip16(static_cast<int32_t>(output_[i] * 32768.0f));
+    }
+    WriteWavHeader(fp, num_frames, input_.sample_rate);
+    fwrite(&pcm_[0], 2, pcm_.size(), fp);
+    fclose(fp);
+    return true;
+  }
+  
+  vector<uint8_t> large_buffer_;
+  vector<uint8_t> small_buffer_;
+  GranularProcessor* processor_;
+  Audio input_;
+  vector<Event> events_;
+  vector<float> output_;
+  vector<int16_t> pcm_;
+  
+  DISALLOW_COPY_AND_ASSIGN(Worker);
+};
+
+// Work-stealing pool: each thread takes jobs from the back of its own queue,
+// then from the front of the others'.
+class JobQueue {
+ public:
+  JobQueue() { }
+  
+  void Push(size_t job) {
+    lock_guard<mutex> lock(mutex_);
+    jobs_.push_back(job);
+  }
+  
+  bool Pop(size_t* job) {
+    lock_guard<mutex> lock(mutex_);
+    if (jobs_.empty()) {
+      return false;
+    }
+    *job = jobs_.back();
+    jobs_.pop_back();
+    return true;
+  }
+  
+  bool Steal(size_t* job) {
+    lock_guard<mutex> lock(mutex_);
+    if (jobs_.empty()) {
+      return false;
+    }
+    *job = jobs_.front();
+    jobs_.pop_front();
+    return true;
+  }
+  
+ private:
+  mutex mutex_;
+  deque<size_t> jobs_;
+  
+  DISALLOW_COPY_AND_ASSIGN(JobQueue);
+};
+
+void RunWorker(int32_t index, vector<JobQueue>* queues, vector<Job>* jobs) {
+#if defined(__x86_64__) || defined(__i386__)
+  _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+#endif  // __x86_64__ || __i386__
+  Worker worker;
+  size_t num_queues = queues->size();
+  while (true) {
+    size_t job;
+    bool found = (*queues)[index].Pop(&job);
+    for (size_t i = 1; i < num_queues && !found; ++i) {
+      found = (*queues)[(index + i) % num_queues].Steal(&job);
+    }
+    if (!found) {
+      break;
+    }
+    (*jobs)[job].worker = index;
+    worker.Render(&(*jobs)[job]);
+  }
+}
+
+bool ParseMode(const char* name, PlaybackMode* mode) {
+  const char* names[] = { "granular", "stretch", "looping", "spectral" };
+  for (int32_t i = 0; i < PLAYBACK_MODE_LAST; ++i) {
+    if (!strcmp(name, names[i])) {
+      *mode = static_cast<PlaybackMode>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ReadJobs(const char* file_name, vector<Job>* jobs) {
+  FILE* fp = fopen(file_name, "r");
+  if (!fp) {
+    fprintf(stderr, "Cannot open %s\n", file_name);
+    return false;
+  }
+  char line[1024];
+  size_t line_number = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    ++line_number;
+    char input[256], script[256], mode[32], output[256];
+    Job job;
+    int32_t n = sscanf(
+        line, "%255s %255s %31s %d %255s",
+        input, script, mode, &job.quality, output);
+    if (n <= 0 || input[0] == '#') {
+      continue;
+    }
+    if (n != 5 || !ParseMode(mode, &job.mode) ||
+        job.quality < 0 || job.quality > 3) {
+      fprintf(stderr, "%s:%d: invalid job\n", file_name, int(line_number));
+      fclose(fp);
+      return false;
+    }
+    job.input = input;
+    job.script = script;
+    job.output = output;
+    job.ok = false;
+    job.num_frames = 0;
+    job.duration = job.elapsed = 0.0;
+    job.worker = -1;
+    jobs->push_back(job);
+  }
+  fclose(fp);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int32_t num_threads = thread::hardware_concurrency();
+  const char* job_list = NULL;
+  for (int32_t i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      num_threads = atoi(argv[++i]);
+    } else {
+      job_list = argv[i];
+    }
+  }
+  if (!job_list) {
+    fprintf(stderr, "Usage: %s [-j threads] jobs.txt\n", argv[0]);
+    return 1;
+  }
+  
+  vector<Job> jobs;
+  if (!ReadJobs(job_list, &jobs)) {
+    return 1;
+  }
+  num_threads = max(1, min(num_threads, static_cast<int32_t>(jobs.size())));
+  
+  vector<JobQueue> queues(num_threads);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    queues[i % num_threads].Push(i);
+  }
+  
+  chrono::high_resolution_clock::time_point start = \
+      chrono::high_resolution_clock::now();
+  vector<thread> threads;
+  for (int32_t i = 0; i < num_threads; ++i) {
+    threads.push_back(thread(RunWorker, i, &queues, &jobs));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  double elapsed = chrono::duration<double>(
+      chrono::high_resolution_clock::now() - start).count();
+  
+  printf(
+      "%-4s %-32s %-9s %3s %9s %9s %8s %12s\n",
+      "job", "input", "mode", "thr", "audio", "time", "x rt", "frames/s");
+  const char* mode_names[] = { "granular", "stretch", "looping", "spectral" };
+  double total_duration = 0.0;
+  double total_elapsed = 0.0;
+  int32_t num_failed = 0;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const Job& job = jobs[i];
+    if (!job.ok) {
+      fprintf(stderr, "job %d failed: %s\n", int(i), job.error.c_str());
+      ++num_failed;
+      continue;
+    }
+    total_duration += job.duration;
+    total_elapsed += job.elapsed;
+    printf(
+        "%-4d %-32s %-9s %3d %8.2fs %8.3fs %8.1f %12.0f\n",
+        int(i),
+        job.input.substr(0, 32).c_str(),
+        mode_names[job.mode],
+        job.worker,
+        job.duration,
+        job.elapsed,
+        job.duration / job.elapsed,
+        job.num_frames / job.elapsed);
+  }
+  printf(
+      "\n%d jobs, %d failed, %d threads: %.1f s of audio in %.2f s, "
+      "%.1fx real time (%.1fx per thread).\n",
+      int(jobs.size()), num_failed, num_threads,
+      total_duration, elapsed,
+      total_duration / elapsed,
+      total_elapsed > 0.0 ? total_duration / total_elapsed : 0.0);
+  return num_failed ? 1 : 0;
+}
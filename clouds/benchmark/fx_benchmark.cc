@@ -0,0 +1,1258 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host benchmarks for the FX engine.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif  // __x86_64__ || __i386__
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // __linux__
+
+#include "clouds/dsp/frame.h"
+#include "clouds/dsp/fx/batch_fx_engine.h"
+#include "clouds/dsp/fx/diffuser.h"
+#include "clouds/dsp/fx/fx_engine.h"
+#include "clouds/dsp/fx/fx_program.h"
+#include "clouds/dsp/fx/pitch_shifter.h"
+#include "clouds/dsp/fx/reverb.h"
+
+using namespace clouds;
+using namespace std;
+
+const size_t kSampleRate = 32000;
+const size_t kBlockSize = 4096;
+const size_t kNumIterations = 2000;
+const size_t kEngineBlockSize = 32;
+const size_t kEngineDuration = kSampleRate * 10;
+const size_t kEnginePasses = 5;
+
+// Prevents the compiler from optimizing away benchmarked computations.
+volatile float sink;
+
+class Stopwatch {
+ public:
+  Stopwatch() { Start(); }
+
+  void Start() {
+    start_ = chrono::high_resolution_clock::now();
+  }
+
+  double ElapsedNanoseconds() const {
+    return chrono::duration<double, nano>(
+        chrono::high_resolution_clock::now() - start_).count();
+  }
+
+ private:
+  chrono::high_resolution_clock::time_point start_;
+};
+
+// Number of time-stamp counter ticks per ns, or 0 when the counter is not
+// available. The TSC runs at the nominal frequency of the CPU, so this is
+// only an estimate of the core cycles when frequency scaling is active.
+double CyclesPerNanosecond() {
+#if defined(__x86_64__) || defined(__i386__)
+  static double cycles_per_ns = 0.0;
+  if (cycles_per_ns == 0.0) {
+    Stopwatch watch;
+    uint64_t start = __rdtsc();
+    while (watch.ElapsedNanoseconds() < 1e8) { }
+    cycles_per_ns = static_cast<double>(__rdtsc() - start) / \
+        watch.ElapsedNanoseconds();
+  }
+  return cycles_per_ns;
+#else
+  return 0.0;
+#endif  // __x86_64__ || __i386__
+}
+
+// Counts the cache misses of the current process, when the hardware counters
+// are available (Linux, and not virtualized).
+class CacheMissCounter {
+ public:
+  CacheMissCounter() {
+    fd_ = -1;
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.disabled = 1;
+    fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif  // __linux__
+  }
+  
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+#endif  // __linux__
+  }
+  
+  bool available() const { return fd_ >= 0; }
+  
+  void Start() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif  // __linux__
+  }
+  
+  void Stop() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    }
+#endif  // __linux__
+  }
+  
+  // Total number of misses counted between Start() and Stop() calls.
+  int64_t count() const {
+    int64_t count = -1;
+#ifdef __linux__
+    if (fd_ >= 0 && read(fd_, &count, sizeof(count)) != sizeof(count)) {
+      count = -1;
+    }
+#endif  // __linux__
+    return count;
+  }
+  
+ private:
+  int fd_;
+};
+
+// Set-associative cache with LRU replacement, to estimate the misses of an
+// access pattern when the hardware counters are not available.
+template<size_t size, size_t ways, size_t line_size>
+class CacheModel {
+ public:
+  CacheModel() {
+    fill(&tag_[0], &tag_[kNumLines], ~size_t(0));
+    fill(&last_use_[0], &last_use_[kNumLines], 0);
+    clock_ = 0;
+    misses_ = 0;
+  }
+  
+  void Access(size_t address) {
+    size_t line = address / line_size;
+    size_t* tag = &tag_[(line % kNumSets) * ways];
+    uint64_t* last_use = &last_use_[(line % kNumSets) * ways];
+    size_t victim = 0;
+    ++clock_;
+    for (size_t i = 0; i < ways; ++i) {
+      if (tag[i] == line) {
+        last_use[i] = clock_;
+        return;
+      }
+      if (last_use[i] < last_use[victim]) {
+        victim = i;
+      }
+    }
+    tag[victim] = line;
+    last_use[victim] = clock_;
+    ++misses_;
+  }
+  
+  int64_t misses() const { return misses_; }
+  
+ private:
+  enum {
+    kNumLines = size / line_size,
+    kNumSets = kNumLines / ways
+  };
+  
+  size_t tag_[kNumLines];
+  uint64_t last_use_[kNumLines];
+  uint64_t clock_;
+  int64_t misses_;
+};
+
+// A typical L1 data cache of a desktop CPU.
+typedef CacheModel<32768, 8, 64> L1DataCache;
+
+void MakeSine(float* out, size_t size, float frequency, float amplitude) {
+  for (size_t i = 0; i < size; ++i) {
+    out[i] = amplitude * sinf(2.0f * M_PI * frequency * i / kSampleRate);
+  }
+}
+
+template<Format format>
+float NoiseFloor(float amplitude) {
+  typedef DataType<format> D;
+  vector<float> x(kBlockSize), y(kBlockSize);
+  vector<typename D::T> encoded(kBlockSize);
+  MakeSine(&x[0], kBlockSize, 997.0f, amplitude);
+  D::Compress(&x[0], &encoded[0], kBlockSize);
+  D::Decompress(&encoded[0], &y[0], kBlockSize);
+  double error = 0.0;
+  for (size_t i = 0; i < kBlockSize; ++i) {
+    error += (y[i] - x[i]) * (y[i] - x[i]);
+  }
+  error = sqrt(error / kBlockSize);
+  return error > 0.0 ? 20.0 * log10(error) : -999.0f;
+}
+
+template<Format format>
+void BenchmarkFormat(const char* name) {
+  typedef DataType<format> D;
+  vector<float> x(kBlockSize), y(kBlockSize);
+  vector<typename D::T> encoded(kBlockSize);
+  MakeSine(&x[0], kBlockSize, 997.0f, 0.5f);
+
+  Stopwatch compress;
+  for (size_t i = 0; i < kNumIterations; ++i) {
+    D::Compress(&x[0], &encoded[0], kBlockSize);
+    sink = encoded[i & (kBlockSize - 1)];
+  }
+  double compress_ns = compress.ElapsedNanoseconds();
+
+  Stopwatch decompress;
+  for (size_t i = 0; i < kNumIterations; ++i) {
+    D::Decompress(&encoded[0], &y[0], kBlockSize);
+    sink = y[i & (kBlockSize - 1)];
+  }
+  double decompress_ns = decompress.ElapsedNanoseconds();
+
+  double n = kBlockSize * kNumIterations;
+  printf("%-20s %6d bits %9.1f dB %9.1f dB %9.3f ns %9.3f ns\n",
+      name,
+      static_cast<int>(8 * sizeof(typename D::T)),
+      NoiseFloor<format>(0.5f),
+      NoiseFloor<format>(0.01f),
+      compress_ns / n,
+      decompress_ns / n);
+}
+
+void BenchmarkFormats() {
+  printf("\nStorage formats: RMS error re. full scale for a 997 Hz sine at ");
+  printf("-6 dBFS and -40 dBFS,\nthen per-sample block Compress/Decompress ");
+  printf("time.\n");
+  BenchmarkFormat<FORMAT_12_BIT>("FORMAT_12_BIT");
+  BenchmarkFormat<FORMAT_16_BIT>("FORMAT_16_BIT");
+  BenchmarkFormat<FORMAT_32_BIT>("FORMAT_32_BIT");
+  BenchmarkFormat<FORMAT_FLOAT16>("FORMAT_FLOAT16");
+  BenchmarkFormat<FORMAT_8_BIT_MULAW>("FORMAT_8_BIT_MULAW");
+}
+
+void MakeNoise(FloatFrame* out, size_t size) {
+  uint32_t state = 0x21;
+  for (size_t i = 0; i < size; ++i) {
+    state = state * 1664525L + 1013904223L;
+    out[i].l = static_cast<float>(static_cast<int32_t>(state)) / 4294967296.0f;
+    state = state * 1664525L + 1013904223L;
+    out[i].r = static_cast<float>(static_cast<int32_t>(state)) / 4294967296.0f;
+  }
+}
+
+// Runs an engine on 10s of noise, in blocks of kEngineBlockSize, and returns
+// the time spent per sample, in ns. The fastest of kEnginePasses passes is
+// kept, to reject the noise caused by other processes.
+template<typename Engine>
+double TimeEngine(Engine* engine, CacheMissCounter* counter = NULL) {
+  vector<FloatFrame> input(kEngineDuration);
+  vector<FloatFrame> block(kEngineBlockSize);
+  MakeNoise(&input[0], kEngineDuration);
+  double fastest = 0.0;
+  for (size_t pass = 0; pass < kEnginePasses; ++pass) {
+    double elapsed = 0.0;
+    for (size_t i = 0; i < kEngineDuration; i += kEngineBlockSize) {
+      copy(&input[i], &input[i + kEngineBlockSize], &block[0]);
+      if (counter) {
+        counter->Start();
+      }
+      Stopwatch watch;
+      engine->Process(&block[0], kEngineBlockSize);
+      elapsed += watch.ElapsedNanoseconds();
+      if (counter) {
+        counter->Stop();
+      }
+      sink = block[0].l;
+    }
+    if (pass == 0 || elapsed < fastest) {
+      fastest = elapsed;
+    }
+  }
+  return fastest / kEngineDuration;
+}
+
+void InitReverb(Reverb* reverb, uint16_t* buffer) {
+  reverb->Init(buffer, kSampleRate);
+  reverb->set_amount(0.5f);
+  reverb->set_diffusion(0.7f);
+  reverb->set_time(0.8f);
+  reverb->set_input_gain(0.2f);
+  reverb->set_lp(0.7f);
+}
+
+void BenchmarkEngines() {
+  printf("\nEngines: time per stereo frame, blocks of %d frames.\n",
+      static_cast<int>(kEngineBlockSize));
+  
+  static uint16_t reverb_buffer[16384];
+  Reverb reverb;
+  InitReverb(&reverb, reverb_buffer);
+  printf("%-20s %9.3f ns\n", "Reverb", TimeEngine(&reverb));
+  
+  static float diffuser_buffer[Diffuser::buffer_size];
+  Diffuser diffuser;
+  diffuser.Init(diffuser_buffer);
+  diffuser.set_amount(0.5f);
+  printf("%-20s %9.3f ns\n", "Diffuser", TimeEngine(&diffuser));
+  diffuser.set_amount(0.0f);
+  printf("%-20s %9.3f ns\n", "Diffuser (bypassed)", TimeEngine(&diffuser));
+  
+  static uint16_t pitch_shifter_buffer[4096];
+  PitchShifter pitch_shifter;
+  pitch_shifter.Init(pitch_shifter_buffer, kNativeSampleRate);
+  pitch_shifter.set_ratio(1.5f);
+  pitch_shifter.set_size(0.5f);
+  printf("%-20s %9.3f ns\n", "PitchShifter", TimeEngine(&pitch_shifter));
+  pitch_shifter.set_ratio(1.0f);
+  printf("%-20s %9.3f ns\n", "PitchShifter (unity)",
+         TimeEngine(&pitch_shifter));
+}
+
+// A single modulated tap, read with each of the interpolation kernels.
+class InterpolationTest {
+ public:
+  void Init(uint16_t* buffer) {
+    engine_.Init(buffer);
+    engine_.SetLFOFrequency(LFO_1, 0.5f / kSampleRate);
+    state_ = 0.0f;
+  }
+  
+  template<InterpolationMethod method>
+  void Process(FloatFrame* in_out, size_t size) {
+    typedef E::Reserve<2000> Memory;
+    E::DelayLine<Memory, 0> line;
+    E::Context c;
+    while (size--) {
+      engine_.Start(&c);
+      c.Read(in_out->l, 1.0f);
+      c.Write(line, 0.0f);
+      Tap<method>(&c, line);
+      c.Write(in_out->r, 0.0f);
+      ++in_out;
+    }
+  }
+  
+ private:
+  typedef FxEngine<4096, FORMAT_16_BIT> E;
+  
+  template<InterpolationMethod method, typename D>
+  void Tap(E::Context* c, D& line) {
+    c->Interpolate<method>(line, 1000.0f, LFO_1, 100.0f, 1.0f);
+  }
+  
+  E engine_;
+  float state_;
+};
+
+template<>
+void InterpolationTest::Tap<INTERPOLATION_ALLPASS>(
+    E::Context* c, E::DelayLine<E::Reserve<2000>, 0>& line) {
+  c->Interpolate<INTERPOLATION_ALLPASS>(
+      line, 1000.0f, LFO_1, 100.0f, 1.0f, state_);
+}
+
+template<InterpolationMethod method>
+class InterpolationTestAdapter {
+ public:
+  InterpolationTestAdapter(InterpolationTest* test) : test_(test) { }
+  void Process(FloatFrame* in_out, size_t size) {
+    test_->Process<method>(in_out, size);
+  }
+ private:
+  InterpolationTest* test_;
+};
+
+void BenchmarkInterpolation() {
+  printf("\nInterpolation kernels: one modulated tap per frame, ");
+  printf("FORMAT_16_BIT.\n");
+  static uint16_t buffer[4096];
+  InterpolationTest test;
+  
+  test.Init(buffer);
+  InterpolationTestAdapter<INTERPOLATION_LINEAR> linear(&test);
+  printf("%-20s %9.3f ns\n", "Linear", TimeEngine(&linear));
+  
+  test.Init(buffer);
+  InterpolationTestAdapter<INTERPOLATION_HERMITE> hermite(&test);
+  printf("%-20s %9.3f ns\n", "Hermite", TimeEngine(&hermite));
+  
+  test.Init(buffer);
+  InterpolationTestAdapter<INTERPOLATION_ALLPASS> allpass(&test);
+  printf("%-20s %9.3f ns\n", "Allpass", TimeEngine(&allpass));
+}
+
+// Four short allpasses followed by two long delays spread over a large external
+// memory, with the allpasses either in the same external buffer, or in the
+// internal memory of the engine.
+template<bool split>
+class SplitMemoryTest {
+ public:
+  typedef FxEngine<1 << 20, FORMAT_32_BIT, 2, 1024> E;
+  
+  template<int32_t l, typename T = typename E::Empty>
+  struct Short : public conditional<
+      split, typename E::template InternalReserve<l, T>,
+      typename E::template Reserve<l, T> >::type { };
+  
+  typedef Short<113,
+    Short<162,
+    Short<241,
+    Short<399,
+    typename E::template Reserve<400000,
+    typename E::template Reserve<600000> > > > > > Memory;
+  
+  void Init(float* buffer) {
+    engine_.Init(buffer);
+    trace_write_ptr_ = 0;
+  }
+  
+  void Process(FloatFrame* in_out, size_t size) {
+    E::DelayLine<Memory, 0> ap1;
+    E::DelayLine<Memory, 1> ap2;
+    E::DelayLine<Memory, 2> ap3;
+    E::DelayLine<Memory, 3> ap4;
+    E::DelayLine<Memory, 4> del1;
+    E::DelayLine<Memory, 5> del2;
+    E::Context c;
+    const float kap = 0.625f;
+    while (size--) {
+      engine_.Start(&c);
+      c.Read(in_out->l + in_out->r, 0.5f);
+      c.Read(ap1 TAIL, kap);
+      c.WriteAllPass(ap1, -kap);
+      c.Read(ap2 TAIL, kap);
+      c.WriteAllPass(ap2, -kap);
+      c.Read(ap3 TAIL, kap);
+      c.WriteAllPass(ap3, -kap);
+      c.Read(ap4 TAIL, kap);
+      c.WriteAllPass(ap4, -kap);
+      c.Read(del2 TAIL, 0.5f);
+      c.Write(del1, 0.0f);
+      c.Read(del1 TAIL, 1.0f);
+      c.Write(del2, 0.0f);
+      c.Read(del2, 100000, 1.0f);
+      c.Write(in_out->l, 0.0f);
+      ++in_out;
+    }
+  }
+  
+  // Replays the delay memory accesses of Process() on a cache model, with the
+  // internal memory placed right after the external buffer.
+  template<typename Cache>
+  void Trace(Cache* cache, size_t size) {
+    while (size--) {
+      Touch<E::DelayLine<Memory, 0> >(cache, -1);
+      Touch<E::DelayLine<Memory, 0> >(cache, 0);
+      Touch<E::DelayLine<Memory, 1> >(cache, -1);
+      Touch<E::DelayLine<Memory, 1> >(cache, 0);
+      Touch<E::DelayLine<Memory, 2> >(cache, -1);
+      Touch<E::DelayLine<Memory, 2> >(cache, 0);
+      Touch<E::DelayLine<Memory, 3> >(cache, -1);
+      Touch<E::DelayLine<Memory, 3> >(cache, 0);
+      Touch<E::DelayLine<Memory, 5> >(cache, -1);
+      Touch<E::DelayLine<Memory, 4> >(cache, 0);
+      Touch<E::DelayLine<Memory, 4> >(cache, -1);
+      Touch<E::DelayLine<Memory, 5> >(cache, 0);
+      Touch<E::DelayLine<Memory, 5> >(cache, 100000);
+      --trace_write_ptr_;
+    }
+  }
+  
+ private:
+  template<typename D, typename Cache>
+  void Touch(Cache* cache, int32_t offset) {
+    int32_t index = trace_write_ptr_ + D::base + \
+        (offset == -1 ? D::length - 1 : offset);
+    size_t cell = D::region == static_cast<int32_t>(MEMORY_INTERNAL)
+        ? E::external_memory_size + (index & (E::internal_memory_size - 1))
+        : index & (E::external_memory_size - 1);
+    cache->Access(cell * sizeof(float));
+  }
+  
+  E engine_;
+  int32_t trace_write_ptr_;
+};
+
+// The Reverb, written as a program. Coefficients: k[0] = diffusion,
+// k[1] = lp, k[2] = reverb time, k[3] = amount, k[4] = input gain.
+class ProgramReverb {
+ public:
+  typedef FxEngine<16384, FORMAT_12_BIT, 2, 1024> E;
+  typedef E::InternalReserve<113,
+    E::InternalReserve<162,
+    E::InternalReserve<241,
+    E::InternalReserve<399,
+    E::Reserve<1653,
+    E::Reserve<2038,
+    E::Reserve<3411,
+    E::Reserve<1913,
+    E::Reserve<1663,
+    E::Reserve<4782> > > > > > > > > > Memory;
+  typedef E::DelayLine<Memory, 0> ap1;
+  typedef E::DelayLine<Memory, 1> ap2;
+  typedef E::DelayLine<Memory, 2> ap3;
+  typedef E::DelayLine<Memory, 3> ap4;
+  typedef E::DelayLine<Memory, 4> dap1a;
+  typedef E::DelayLine<Memory, 5> dap1b;
+  typedef E::DelayLine<Memory, 6> del1;
+  typedef E::DelayLine<Memory, 7> dap2a;
+  typedef E::DelayLine<Memory, 8> dap2b;
+  typedef E::DelayLine<Memory, 9> del2;
+  
+  typedef Program<
+    op::Interpolate<ap1, 10, LFO_1, 60, op::One>,
+    op::Write<ap1, 100, op::Zero>,
+    op::ReadMono<op::K<4> >,
+    op::Read<ap1, kTail, op::K<0> >,
+    op::WriteAllPass<ap1, 0, op::NegK<0> >,
+    op::Read<ap2, kTail, op::K<0> >,
+    op::WriteAllPass<ap2, 0, op::NegK<0> >,
+    op::Read<ap3, kTail, op::K<0> >,
+    op::WriteAllPass<ap3, 0, op::NegK<0> >,
+    op::Read<ap4, kTail, op::K<0> >,
+    op::WriteAllPass<ap4, 0, op::NegK<0> >,
+    op::Store<0>,
+    op::Load<0>,
+    op::Interpolate<del2, 4680, LFO_2, 100, op::K<2> >,
+    op::Lp<0, op::K<1> >,
+    op::Read<dap1a, kTail, op::NegK<0> >,
+    op::WriteAllPass<dap1a, 0, op::K<0> >,
+    op::Read<dap1b, kTail, op::K<0> >,
+    op::WriteAllPass<dap1b, 0, op::NegK<0> >,
+    op::Write<del1, 0, op::Gain<2> >,
+    op::Crossfade<0, op::K<3> >,
+    op::Load<0>,
+    op::Read<del1, kTail, op::K<2> >,
+    op::Lp<1, op::K<1> >,
+    op::Read<dap2a, kTail, op::K<0> >,
+    op::WriteAllPass<dap2a, 0, op::NegK<0> >,
+    op::Read<dap2b, kTail, op::NegK<0> >,
+    op::WriteAllPass<dap2b, 0, op::K<0> >,
+    op::Write<del2, 0, op::Gain<2> >,
+    op::Crossfade<1, op::K<3> > > Network;
+  
+  void Init(uint16_t* buffer, bool interpreted) {
+    engine_.Init(buffer);
+    engine_.SetLFOFrequency(LFO_1, 0.5f / 32000.0f);
+    engine_.SetLFOFrequency(LFO_2, 0.3f / 32000.0f);
+    fill(&state_.filters[0], &state_.filters[kProgramNumFilters], 0.0f);
+    state_.k[0] = 0.7f;
+    state_.k[1] = 0.7f;
+    state_.k[2] = 0.8f;
+    state_.k[3] = 0.5f;
+    state_.k[4] = 0.2f;
+    interpreted_ = interpreted;
+    interpreter_.Init();
+    interpreter_.Load<Network>();
+  }
+  
+  void Process(FloatFrame* in_out, size_t size) {
+    if (interpreted_) {
+      interpreter_.Process(&engine_, &state_, in_out, size);
+    } else {
+      Network::Process(&engine_, &state_, in_out, size);
+    }
+  }
+  
+ private:
+  E engine_;
+  ProgramState state_;
+  ProgramInterpreter<E> interpreter_;
+  bool interpreted_;
+};
+
+// Runs two engines on 1s of noise and returns the largest difference between
+// their outputs.
+template<typename A, typename B>
+float MaxDifference(A* a, B* b) {
+  vector<FloatFrame> out_a(kSampleRate);
+  vector<FloatFrame> out_b(kSampleRate);
+  MakeNoise(&out_a[0], kSampleRate);
+  MakeNoise(&out_b[0], kSampleRate);
+  float difference = 0.0f;
+  for (size_t i = 0; i < kSampleRate; i += kEngineBlockSize) {
+    a->Process(&out_a[i], kEngineBlockSize);
+    b->Process(&out_b[i], kEngineBlockSize);
+  }
+  for (size_t i = 0; i < kSampleRate; ++i) {
+    difference = max(difference, fabs(out_a[i].l - out_b[i].l));
+    difference = max(difference, fabs(out_a[i].r - out_b[i].r));
+  }
+  return difference;
+}
+
+// The compiled program must be bit-identical to the hand-written Reverb. The
+// interpreter performs the same operations in the same order, but the
+// compiler is free to fuse multiplications and additions (-ffp-contract) in
+// one and not in the other. The rounding differences occasionally flip the
+// last bit of a 12-bit sample stored in the delay memory, so the interpreter
+// is only required to stay within a few LSBs. With -ffp-contract=off, both
+// are bit-identical.
+bool BenchmarkPrograms() {
+  printf("\nPrograms: the Reverb written as a %d instructions program, and ",
+      static_cast<int>(ProgramReverb::Network::size));
+  printf("the largest\ndifference with the hand-written version.\n");
+  static uint16_t buffer_a[16384];
+  static uint16_t buffer_b[16384];
+  bool ok = true;
+  for (int interpreted = 0; interpreted < 2; ++interpreted) {
+    const char* name = interpreted ? "Interpreted" : "Compiled";
+    Reverb* reverb = new Reverb;
+    ProgramReverb* program = new ProgramReverb;
+    InitReverb(reverb, buffer_a);
+    program->Init(buffer_b, interpreted);
+    float difference = MaxDifference(reverb, program);
+    ok = ok && difference <= (interpreted ? 1e-3f : 0.0f);
+    program->Init(buffer_b, interpreted);
+    printf("%-20s %9.3f ns %9.3g\n", name, TimeEngine(program), difference);
+    delete program;
+    delete reverb;
+  }
+  
+  // Instruction tables are checked when they are loaded: the stateful
+  // ALLPASS kernel, the LFOs the engine does not have, and modulated taps
+  // which leave their line are rejected.
+  ProgramInstruction instructions[kProgramMaxSize];
+  size_t size = ProgramReverb::Network::Assemble(instructions);
+  ProgramInterpreter<ProgramReverb::E>* interpreter = \
+      new ProgramInterpreter<ProgramReverb::E>;
+  interpreter->Init();
+  bool checked = interpreter->Load(instructions, size);
+  instructions[0].method = INTERPOLATION_ALLPASS;
+  checked = checked && !interpreter->Load(instructions, size);
+  instructions[0].method = INTERPOLATION_LINEAR;
+  instructions[0].lfo = LFO_3;
+  checked = checked && !interpreter->Load(instructions, size);
+  instructions[0].lfo = LFO_1;
+  checked = checked && interpreter->Load(instructions, size);
+  instructions[0].amplitude = static_cast<float>(instructions[0].length);
+  checked = checked && !interpreter->Load(instructions, size);
+  instructions[0].amplitude = -1.0f - instructions[0].offset;
+  checked = checked && !interpreter->Load(instructions, size);
+  printf("%-20s %s\n", "Load() checks", checked ? "passed" : "FAILED");
+  delete interpreter;
+  return ok && checked;
+}
+
+// The Diffuser, as written before the Context had several accumulators.
+class SerialDiffuser {
+ public:
+  void Init(float* buffer) {
+    engine_.Init(buffer);
+  }
+  
+  void Process(FloatFrame* in_out, size_t size) {
+    typedef E::Reserve<126,
+      E::Reserve<180,
+      E::Reserve<269,
+      E::Reserve<444,
+      E::Reserve<151,
+      E::Reserve<205,
+      E::Reserve<245,
+      E::Reserve<405> > > > > > > > Memory;
+    E::DelayLine<Memory, 0> apl1;
+    E::DelayLine<Memory, 1> apl2;
+    E::DelayLine<Memory, 2> apl3;
+    E::DelayLine<Memory, 3> apl4;
+    E::DelayLine<Memory, 4> apr1;
+    E::DelayLine<Memory, 5> apr2;
+    E::DelayLine<Memory, 6> apr3;
+    E::DelayLine<Memory, 7> apr4;
+    E::Context c;
+    const float kap = 0.625f;
+    while (size--) {
+      engine_.Start(&c);
+      
+      float wet = 0.0f;
+      c.Read(in_out->l);
+      c.Read(apl1 TAIL, kap);
+      c.WriteAllPass(apl1, -kap);
+      c.Read(apl2 TAIL, kap);
+      c.WriteAllPass(apl2, -kap);
+      c.Read(apl3 TAIL, kap);
+      c.WriteAllPass(apl3, -kap);
+      c.Read(apl4 TAIL, kap);
+      c.WriteAllPass(apl4, -kap);
+      c.Write(wet, 0.0f);
+      in_out->l += amount_ * (wet - in_out->l);
+      
+      c.Read(in_out->r);
+      c.Read(apr1 TAIL, kap);
+      c.WriteAllPass(apr1, -kap);
+      c.Read(apr2 TAIL, kap);
+      c.WriteAllPass(apr2, -kap);
+      c.Read(apr3 TAIL, kap);
+      c.WriteAllPass(apr3, -kap);
+      c.Read(apr4 TAIL, kap);
+      c.WriteAllPass(apr4, -kap);
+      c.Write(wet, 0.0f);
+      in_out->r += amount_ * (wet - in_out->r);
+
+      ++in_out;
+    }
+  }
+  
+  void set_amount(float amount) {
+    amount_ = amount;
+  }
+  
+ private:
+  typedef FxEngine<2048, FORMAT_32_BIT> E;
+  E engine_;
+  float amount_;
+};
+
+void PrintTimeAndCycles(const char* name, double ns, float difference) {
+  double cycles_per_ns = CyclesPerNanosecond();
+  if (cycles_per_ns) {
+    printf("%-20s %9.3f ns %9.1f cycles %9.3g\n",
+        name, ns, ns * cycles_per_ns, difference);
+  } else {
+    printf("%-20s %9.3f ns       n/a cycles %9.3g\n", name, ns, difference);
+  }
+}
+
+// The engines using several accumulators must be bit-identical to their
+// single accumulator versions: only the order of independent operations
+// changes. The serial Reverb is the compiled Reverb program.
+bool BenchmarkAccumulators() {
+  printf("\nAccumulators: time, TSC cycles per frame and largest difference ");
+  printf("between the\nserial (1 accumulator) and interleaved ");
+  printf("(2 accumulators) versions.\n");
+  bool ok = true;
+  
+  static uint16_t reverb_buffer_a[16384];
+  static uint16_t reverb_buffer_b[16384];
+  Reverb* reverb = new Reverb;
+  ProgramReverb* serial_reverb = new ProgramReverb;
+  InitReverb(reverb, reverb_buffer_a);
+  serial_reverb->Init(reverb_buffer_b, false);
+  float difference = MaxDifference(reverb, serial_reverb);
+  ok = ok && difference == 0.0f;
+  InitReverb(reverb, reverb_buffer_a);
+  serial_reverb->Init(reverb_buffer_b, false);
+  PrintTimeAndCycles("Reverb (serial)", TimeEngine(serial_reverb), 0.0f);
+  PrintTimeAndCycles("Reverb", TimeEngine(reverb), difference);
+  delete serial_reverb;
+  delete reverb;
+  
+  static float diffuser_buffer_a[Diffuser::buffer_size];
+  static float diffuser_buffer_b[2048];
+  Diffuser* diffuser = new Diffuser;
+  SerialDiffuser* serial_diffuser = new SerialDiffuser;
+  diffuser->Init(diffuser_buffer_a);
+  diffuser->set_amount(0.5f);
+  serial_diffuser->Init(diffuser_buffer_b);
+  serial_diffuser->set_amount(0.5f);
+  difference = MaxDifference(diffuser, serial_diffuser);
+  ok = ok && difference == 0.0f;
+  PrintTimeAndCycles("Diffuser (serial)", TimeEngine(serial_diffuser), 0.0f);
+  PrintTimeAndCycles("Diffuser", TimeEngine(diffuser), difference);
+  delete serial_diffuser;
+  delete diffuser;
+  
+  return ok;
+}
+
+// A network with a few allpasses and a modulated feedback delay, using a
+// circular (rebase_period = 0) or linear delay memory.
+template<Format format, size_t rebase_period>
+class LinearBufferTest {
+ public:
+  typedef FxEngine<16384, format, 2, 0, rebase_period> E;
+  
+  void Init(typename E::T* buffer) {
+    engine_.Init(buffer);
+    engine_.SetLFOFrequency(LFO_1, 0.5f / kSampleRate);
+    lp_ = 0.0f;
+  }
+  
+  void Process(FloatFrame* in_out, size_t size) {
+    typedef typename E::template Reserve<399,
+      typename E::template Reserve<1653,
+      typename E::template Reserve<2038,
+      typename E::template Reserve<9000> > > > Memory;
+    typename E::template DelayLine<Memory, 0> ap1;
+    typename E::template DelayLine<Memory, 1> ap2;
+    typename E::template DelayLine<Memory, 2> ap3;
+    typename E::template DelayLine<Memory, 3> del;
+    typename E::Context c;
+    while (size--) {
+      engine_.Start(&c);
+      c.Read(in_out->l + in_out->r, 0.25f);
+      c.Interpolate(del, 8000.0f, LFO_1, 500.0f, 0.5f);
+      c.Lp(lp_, 0.3f);
+      c.Read(ap1 TAIL, 0.6f);
+      c.WriteAllPass(ap1, -0.6f);
+      c.Read(ap2 TAIL, 0.6f);
+      c.WriteAllPass(ap2, -0.6f);
+      c.Read(ap3 TAIL, 0.6f);
+      c.WriteAllPass(ap3, -0.6f);
+      c.Write(del, 1.0f);
+      c.Write(in_out->l, 0.0f);
+      in_out->r = in_out->l;
+      ++in_out;
+    }
+  }
+  
+ private:
+  E engine_;
+  float lp_;
+};
+
+template<Format format, size_t rebase_period>
+double TimeLinearBuffer(float* difference) {
+  typedef LinearBufferTest<format, rebase_period> Linear;
+  typedef LinearBufferTest<format, 0> Circular;
+  vector<typename Linear::E::T> linear_buffer(Linear::E::buffer_size);
+  vector<typename Circular::E::T> circular_buffer(Circular::E::buffer_size);
+  Linear* linear = new Linear;
+  Circular* circular = new Circular;
+  linear->Init(&linear_buffer[0]);
+  circular->Init(&circular_buffer[0]);
+  *difference = MaxDifference(linear, circular);
+  linear->Init(&linear_buffer[0]);
+  double ns = TimeEngine(linear);
+  delete circular;
+  delete linear;
+  return ns;
+}
+
+template<Format format>
+bool BenchmarkLinearBuffer(const char* name) {
+  float difference[3];
+  double masked = TimeLinearBuffer<format, 0>(&difference[0]);
+  double linear_256 = TimeLinearBuffer<format, 256>(&difference[1]);
+  double linear_4096 = TimeLinearBuffer<format, 4096>(&difference[2]);
+  printf("%-20s %9.3f ns %9.3f ns %9.3f ns\n",
+      name, masked, linear_256, linear_4096);
+  return difference[0] == 0.0f && \
+      difference[1] == 0.0f && \
+      difference[2] == 0.0f;
+}
+
+// The linear buffer must not change the output.
+bool BenchmarkLinearBuffers() {
+  printf("\nLinear buffers: 3 allpasses and a modulated delay in a 16k ");
+  printf("samples buffer, time\nper frame with masked accesses, and with a ");
+  printf("linear buffer rebased every 256 and\n4096 samples.\n");
+  bool ok = true;
+  ok = BenchmarkLinearBuffer<FORMAT_12_BIT>("FORMAT_12_BIT") && ok;
+  ok = BenchmarkLinearBuffer<FORMAT_16_BIT>("FORMAT_16_BIT") && ok;
+  ok = BenchmarkLinearBuffer<FORMAT_32_BIT>("FORMAT_32_BIT") && ok;
+  ok = BenchmarkLinearBuffer<FORMAT_FLOAT16>("FORMAT_FLOAT16") && ok;
+  ok = BenchmarkLinearBuffer<FORMAT_8_BIT_MULAW>("FORMAT_8_BIT_MULAW") && ok;
+  return ok;
+}
+
+// The PitchShifter, computed in fixed point with the dual-MAC kernels.
+class FixedPitchShifter {
+ public:
+  void Init(uint16_t* buffer) {
+    engine_.Init(buffer);
+    phase_ = 0;
+    size_ = kPitchShifterMaxSize;
+  }
+  
+  void Process(FloatFrame* input_output, size_t size) {
+    typedef E::Reserve<2047, E::Reserve<2047> > Memory;
+    E::DelayLine<Memory, 0> left;
+    E::DelayLine<Memory, 1> right;
+    E::FixedContext c;
+    while (size--) {
+      engine_.Start(&c);
+      
+      phase_ += (1.0f - ratio_) / size_;
+      if (phase_ >= 1.0f) {
+        phase_ -= 1.0f;
+      }
+      if (phase_ <= 0.0f) {
+        phase_ += 1.0f;
+      }
+      float tri = 2.0f * (phase_ >= 0.5f ? 1.0f - phase_ : phase_);
+      float phase = phase_ * size_;
+      float half = phase + size_ * 0.5f;
+      if (half >= size_) {
+        half -= size_;
+      }
+      int16_t gain = Q15(tri);
+      int16_t complement = Q15(1.0f - tri);
+      int16_t out;
+      
+      c.Load(Q15(input_output->l));
+      c.Write(left, 0, 0);
+      c.Interpolate(left, phase, gain);
+      c.Interpolate(left, half, complement);
+      c.Write(out, 0);
+      input_output->l = static_cast<float>(out) / 32768.0f;
+
+      c.Load(Q15(input_output->r));
+      c.Write(right, 0, 0);
+      c.Interpolate(right, phase, gain);
+      c.Interpolate(right, half, complement);
+      c.Write(out, 0);
+      input_output->r = static_cast<float>(out) / 32768.0f;
+      
+      ++input_output;
+    }
+  }
+  
+  inline void set_ratio(float ratio) {
+    ratio_ = ratio;
+  }
+  
+  inline void set_size(float size) {
+    float target_size = 128.0f + \
+        (kPitchShifterMaxSize - 128.0f) * size * size * size;
+    ONE_POLE(size_, target_size, 0.05f)
+  }
+  
+ private:
+  typedef FxEngine<4096, FORMAT_16_BIT> E;
+  E engine_;
+  float phase_;
+  float ratio_;
+  float size_;
+};
+
+// RMS difference, re. full scale, between the outputs of two engines on 1s
+// of a 997 Hz sine at -6 dBFS.
+template<typename A, typename B>
+float RmsDifference(A* a, B* b) {
+  vector<float> sine(kSampleRate);
+  vector<FloatFrame> out_a(kSampleRate);
+  vector<FloatFrame> out_b(kSampleRate);
+  MakeSine(&sine[0], kSampleRate, 997.0f, 0.5f);
+  for (size_t i = 0; i < kSampleRate; ++i) {
+    out_a[i].l = out_a[i].r = out_b[i].l = out_b[i].r = sine[i];
+  }
+  for (size_t i = 0; i < kSampleRate; i += kEngineBlockSize) {
+    a->Process(&out_a[i], kEngineBlockSize);
+    b->Process(&out_b[i], kEngineBlockSize);
+  }
+  double error = 0.0;
+  for (size_t i = 0; i < kSampleRate; ++i) {
+    error += (out_a[i].l - out_b[i].l) * (out_a[i].l - out_b[i].l);
+  }
+  error = sqrt(error / kSampleRate);
+  return error > 0.0 ? 20.0 * log10(error) : -999.0f;
+}
+
+void BenchmarkFixedPoint() {
+  printf("\nFixed point: PitchShifter in float and in Q15 with dual-MAC ");
+  printf("interpolation, time,\nTSC cycles per frame and RMS difference ");
+  printf("with the float version in dB.\n");
+  static uint16_t buffer_a[4096];
+  static uint16_t buffer_b[4096];
+  PitchShifter* pitch_shifter = new PitchShifter;
+  FixedPitchShifter* fixed_pitch_shifter = new FixedPitchShifter;
+  pitch_shifter->Init(buffer_a, kNativeSampleRate);
+  pitch_shifter->set_ratio(1.5f);
+  fixed_pitch_shifter->Init(buffer_b);
+  fixed_pitch_shifter->set_ratio(1.5f);
+  // The size is smoothed.
+  for (size_t i = 0; i < 1000; ++i) {
+    pitch_shifter->set_size(0.5f);
+    fixed_pitch_shifter->set_size(0.5f);
+  }
+  // The float version fades in from bypass: run both on silence until it is
+  // fully wet.
+  FloatFrame silence[64];
+  std::fill(&silence[0].l, &silence[64].l, 0.0f);
+  pitch_shifter->Process(silence, 64);
+  fixed_pitch_shifter->Process(silence, 64);
+  float difference = RmsDifference(pitch_shifter, fixed_pitch_shifter);
+  PrintTimeAndCycles("Float", TimeEngine(pitch_shifter), 0.0f);
+  PrintTimeAndCycles("Q15", TimeEngine(fixed_pitch_shifter), difference);
+  delete fixed_pitch_shifter;
+  delete pitch_shifter;
+}
+
+// A mono network: an input diffuser and a modulated, filtered feedback
+// delay. It is written once, for an FxEngine processing one track or a
+// BatchFxEngine processing kNumLanes tracks; in the latter case, the samples
+// of all tracks are interleaved.
+const size_t kNumLanes = 8;
+
+template<typename E, size_t lanes>
+class ChainTest {
+ public:
+  void Init(float* buffer) {
+    engine_.Init(buffer);
+    engine_.SetLFOFrequency(LFO_1, 0.3f / kSampleRate);
+    fill(&lp_[0], &lp_[lanes], 0.0f);
+  }
+  
+  void Process(float* in_out, size_t size) {
+    typedef typename E::template Reserve<113,
+      typename E::template Reserve<162,
+      typename E::template Reserve<241,
+      typename E::template Reserve<399,
+      typename E::template Reserve<3000> > > > > Memory;
+    typename E::template DelayLine<Memory, 0> ap1;
+    typename E::template DelayLine<Memory, 1> ap2;
+    typename E::template DelayLine<Memory, 2> ap3;
+    typename E::template DelayLine<Memory, 3> ap4;
+    typename E::template DelayLine<Memory, 4> del;
+    typename E::Context c;
+    while (size--) {
+      engine_.Start(&c);
+      Read(&c, in_out);
+      c.Read(ap1 TAIL, 0.625f);
+      c.WriteAllPass(ap1, -0.625f);
+      c.Read(ap2 TAIL, 0.625f);
+      c.WriteAllPass(ap2, -0.625f);
+      c.Read(ap3 TAIL, 0.625f);
+      c.WriteAllPass(ap3, -0.625f);
+      c.Read(ap4 TAIL, 0.625f);
+      c.WriteAllPass(ap4, -0.625f);
+      c.Interpolate(del, 2800.0f, LFO_1, 150.0f, 0.7f);
+      Lp(&c);
+      c.Write(del, 0.5f);
+      Write(&c, in_out);
+      in_out += lanes;
+    }
+  }
+  
+ private:
+  // The single instance Context takes scalars instead of arrays.
+  typedef typename FxEngine<4096, FORMAT_32_BIT>::Context ScalarContext;
+  
+  template<typename Context>
+  inline void Read(Context* c, float* in) {
+    c->Read(in);
+  }
+  
+  inline void Read(ScalarContext* c, float* in) {
+    c->Read(*in);
+  }
+  
+  template<typename Context>
+  inline void Write(Context* c, float* out) {
+    c->Write(out, 0.0f);
+  }
+  
+  inline void Write(ScalarContext* c, float* out) {
+    c->Write(*out, 0.0f);
+  }
+  
+  template<typename Context>
+  inline void Lp(Context* c) {
+    c->Lp(lp_, 0.4f);
+  }
+  
+  inline void Lp(ScalarContext* c) {
+    c->Lp(lp_[0], 0.4f);
+  }
+  
+  E engine_;
+  float lp_[lanes];
+};
+
+typedef ChainTest<FxEngine<4096, FORMAT_32_BIT>, 1> ScalarChain;
+typedef ChainTest<BatchFxEngine<4096, kNumLanes>, kNumLanes> BatchChain;
+
+bool BenchmarkBatch() {
+  printf("\nBatch: %d mono tracks through a diffuser and a modulated delay, ",
+      static_cast<int>(kNumLanes));
+  printf("time per sample\nand per track.\n");
+  
+  // Deinterleaved and interleaved versions of the same tracks.
+  vector<float> tracks(kSampleRate * kNumLanes);
+  vector<float> interleaved(kSampleRate * kNumLanes);
+  vector<FloatFrame> noise(kSampleRate * kNumLanes / 2);
+  MakeNoise(&noise[0], noise.size());
+  copy(&noise[0].l, &noise[0].l + tracks.size(), &tracks[0]);
+  for (size_t i = 0; i < kSampleRate; ++i) {
+    for (size_t j = 0; j < kNumLanes; ++j) {
+      interleaved[i * kNumLanes + j] = tracks[j * kSampleRate + i];
+    }
+  }
+  
+  static float scalar_buffer[kNumLanes][4096];
+  static float batch_buffer[4096 * kNumLanes];
+  vector<ScalarChain> scalar(kNumLanes);
+  BatchChain* batch = new BatchChain;
+  
+  double scalar_time = 0.0;
+  double batch_time = 0.0;
+  bool ok = true;
+  for (size_t pass = 0; pass < kEnginePasses; ++pass) {
+    vector<float> scalar_out(tracks);
+    vector<float> batch_out(interleaved);
+    
+    Stopwatch watch;
+    for (size_t j = 0; j < kNumLanes; ++j) {
+      scalar[j].Init(scalar_buffer[j]);
+      for (size_t i = 0; i < kSampleRate; i += kEngineBlockSize) {
+        scalar[j].Process(&scalar_out[j * kSampleRate + i], kEngineBlockSize);
+      }
+    }
+    double elapsed = watch.ElapsedNanoseconds();
+    if (pass == 0 || elapsed < scalar_time) {
+      scalar_time = elapsed;
+    }
+    
+    watch.Start();
+    batch->Init(batch_buffer);
+    for (size_t i = 0; i < kSampleRate; i += kEngineBlockSize) {
+      batch->Process(&batch_out[i * kNumLanes], kEngineBlockSize);
+    }
+    elapsed = watch.ElapsedNanoseconds();
+    if (pass == 0 || elapsed < batch_time) {
+      batch_time = elapsed;
+    }
+    
+    for (size_t i = 0; i < kSampleRate; ++i) {
+      for (size_t j = 0; j < kNumLanes; ++j) {
+        ok = ok && batch_out[i * kNumLanes + j] == \
+            scalar_out[j * kSampleRate + i];
+      }
+    }
+  }
+  delete batch;
+  
+  const double scale = 1.0 / (kSampleRate * kNumLanes);
+  printf("%-20s %9.3f ns\n", "FxEngine", scalar_time * scale);
+  printf("%-20s %9.3f ns %s\n", "BatchFxEngine", batch_time * scale,
+      ok ? "identical" : "MISMATCH");
+  return ok;
+}
+
+// A BatchFxEngine whose size is not a power of two, with an interpolated tap
+// modulated below the write pointer of a line at the start of the memory. The
+// memory is surrounded with NaNs: reading outside of it shows in the output.
+bool CheckBatchWrap() {
+  const size_t kLanes = 4;
+  const size_t kGuard = 4096;
+  typedef BatchFxEngine<3000, kLanes> E;
+  static float memory[kGuard + E::buffer_size + kGuard];
+  fill(&memory[0], &memory[kGuard], NAN);
+  fill(&memory[kGuard + E::buffer_size], &memory[2 * kGuard + E::buffer_size],
+      NAN);
+  E* engine = new E;
+  engine->Init(&memory[kGuard]);
+  engine->SetLFOFrequency(LFO_1, 50.0f / kSampleRate);
+  
+  typedef E::Reserve<999, E::Reserve<1999> > Memory;
+  E::DelayLine<Memory, 0> line;
+  E::DelayLine<Memory, 1> other;
+  E::Context c;
+  const int32_t offsets[kLanes] = { 0, 1, 500, 998 };
+  float in_out[kLanes];
+  bool ok = true;
+  for (size_t i = 0; i < kSampleRate; ++i) {
+    engine->Start(&c);
+    for (size_t j = 0; j < kLanes; ++j) {
+      in_out[j] = sinf(static_cast<float>(i * (j + 1)) * 0.01f);
+    }
+    c.Read(in_out);
+    c.Write(line, 0.5f);
+    c.Write(other, 0.0f);
+    c.Interpolate(line, -1.5f, LFO_1, 1.0f, 0.5f);
+    c.Read(line, offsets, 0.25f);
+    c.Interpolate(other, 1997.5f, LFO_1, 1.0f, 0.25f);
+    c.Write(in_out, 0.0f);
+    for (size_t j = 0; j < kLanes; ++j) {
+      ok = ok && !isnan(in_out[j]);
+    }
+  }
+  for (size_t i = 0; i < kGuard; ++i) {
+    ok = ok && isnan(memory[i]) && isnan(memory[kGuard + E::buffer_size + i]);
+  }
+  delete engine;
+  printf("%-20s %12s %s\n", "Wrap, size 3000", "",
+      ok ? "inside the memory" : "OUT OF BOUNDS");
+  return ok;
+}
+
+template<bool split>
+void BenchmarkPlacement(const char* name) {
+  static vector<float> buffer(1 << 20);
+  SplitMemoryTest<split>* test = new SplitMemoryTest<split>;
+  test->Init(&buffer[0]);
+  CacheMissCounter counter;
+  double ns = TimeEngine(test, &counter);
+  if (counter.available()) {
+    printf("%-20s %9.3f ns %9.3f misses\n", name, ns,
+        static_cast<double>(counter.count()) / \
+            (kEngineDuration * kEnginePasses));
+  } else {
+    L1DataCache* cache = new L1DataCache;
+    test->Trace(cache, kEngineDuration * kEnginePasses);
+    printf("%-20s %9.3f ns %9.3f misses (simulated L1)\n", name, ns,
+        static_cast<double>(cache->misses()) / \
+            (kEngineDuration * kEnginePasses));
+    delete cache;
+  }
+  delete test;
+}
+
+void BenchmarkMemoryPlacement() {
+  printf("\nMemory placement: 4 allpasses + 2 long delays in a 4MB buffer, ");
+  printf("time and cache\nmisses per frame. Without hardware counters, the ");
+  printf("misses of the delay memory\naccesses are simulated on a 32kB, ");
+  printf("8-way L1 data cache.\n");
+  BenchmarkPlacement<false>("Unified");
+  BenchmarkPlacement<true>("Split");
+}
+
+int main(void) {
+  BenchmarkFormats();
+  BenchmarkEngines();
+  BenchmarkInterpolation();
+  BenchmarkMemoryPlacement();
+  bool ok = BenchmarkPrograms();
+  ok = BenchmarkAccumulators() && ok;
+  ok = BenchmarkLinearBuffers() && ok;
+  BenchmarkFixedPoint();
+  ok = BenchmarkBatch() && ok;
+  ok = CheckBatchWrap() && ok;
+  return ok ? 0 : EXIT_FAILURE;
+}
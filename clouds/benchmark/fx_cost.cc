@@ -0,0 +1,119 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Cost model of the FX engines: memory accesses and conversions per stereo
+// frame, counted by an instrumented build of FxEngine, and the cycles they
+// would take on the target.
+
+#include <cstdio>
+#include <vector>
+
+#include "clouds/dsp/frame.h"
+#include "clouds/dsp/fx/diffuser.h"
+#include "clouds/dsp/fx/fx_engine.h"
+#include "clouds/dsp/fx/pitch_shifter.h"
+#include "clouds/dsp/fx/reverb.h"
+
+#ifndef FX_ENGINE_COST_MODEL
+#error "This program must be built with -DFX_ENGINE_COST_MODEL"
+#endif  // FX_ENGINE_COST_MODEL
+
+using namespace clouds;
+using namespace std;
+
+const size_t kSampleRate = 32000;
+const size_t kBlockSize = 32;
+
+// Approximate cost of each operation on a Cortex-M7, in cycles, assuming
+// that the delay memory is in a zero wait state RAM. Interpolations are
+// counted on top of the reads and conversions of their taps (computation of
+// the integral and fractional parts, and of the kernel).
+const float kReadCycles = 1.0f;
+const float kWriteCycles = 1.0f;
+const float kInterpolationCycles = 4.0f;
+const float kLFOEvaluationCycles = 2.0f;
+const float kCompressionCycles = 3.0f;
+const float kDecompressionCycles = 2.0f;
+
+template<typename Engine>
+void PrintCost(const char* name, Engine* engine) {
+  vector<FloatFrame> block(kBlockSize);
+  fx_engine_cost().Reset();
+  for (size_t i = 0; i < kSampleRate; i += kBlockSize) {
+    fill(&block[0].l, &block[kBlockSize].l, 0.1f);
+    engine->Process(&block[0], kBlockSize);
+  }
+  const FxEngineCost& cost = fx_engine_cost();
+  const float scale = 1.0f / static_cast<float>(cost.samples);
+  float cycles = kReadCycles * cost.reads + \
+      kWriteCycles * cost.writes + \
+      kInterpolationCycles * cost.interpolations + \
+      kLFOEvaluationCycles * cost.lfo_evaluations + \
+      kCompressionCycles * cost.compressions + \
+      kDecompressionCycles * cost.decompressions;
+  printf("%-14s %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %7.1f\n",
+      name,
+      cost.reads * scale,
+      cost.writes * scale,
+      cost.interpolations * scale,
+      cost.lfo_evaluations * scale,
+      cost.compressions * scale,
+      cost.decompressions * scale,
+      cost.bytes * scale,
+      cycles * scale);
+}
+
+int main(void) {
+  printf("\nCost model: operations per stereo frame, memory traffic in bytes ");
+  printf("and estimated\nCortex-M7 cycles spent on delay memory accesses.\n");
+  printf("%-14s %6s %6s %6s %6s %6s %6s %6s %7s\n",
+      "", "read", "write", "interp", "lfo", "compr", "decmp", "bytes",
+      "cycles");
+  
+  static uint16_t reverb_buffer[16384];
+  Reverb reverb;
+  reverb.Init(reverb_buffer, kSampleRate);
+  reverb.set_amount(0.5f);
+  reverb.set_diffusion(0.7f);
+  reverb.set_time(0.8f);
+  reverb.set_input_gain(0.2f);
+  reverb.set_lp(0.7f);
+  PrintCost("Reverb", &reverb);
+  
+  static float diffuser_buffer[Diffuser::buffer_size];
+  Diffuser diffuser;
+  diffuser.Init(diffuser_buffer);
+  diffuser.set_amount(0.5f);
+  PrintCost("Diffuser", &diffuser);
+  
+  static uint16_t pitch_shifter_buffer[4096];
+  PitchShifter pitch_shifter;
+  pitch_shifter.Init(pitch_shifter_buffer, kNativeSampleRate);
+  pitch_shifter.set_ratio(1.5f);
+  pitch_shifter.set_size(0.5f);
+  PrintCost("PitchShifter", &pitch_shifter);
+  return 0;
+}
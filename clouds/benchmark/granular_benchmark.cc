@@ -0,0 +1,547 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host benchmark for the granular processor. The processor is given large
+// buffers, which it splits into blocks of kMaxBlockSize frames; this program
+// is built once for each block size.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "clouds/dsp/granular_processor.h"
+
+using namespace clouds;
+using namespace std;
+
+const size_t kSampleRate = 32000;
+const size_t kBlockSize = 4096;
+const size_t kDuration = kSampleRate * 10;
+const size_t kPasses = 3;
+
+// Prepare() is called from the main loop of the module, about once per block
+// of 32 frames.
+const size_t kPrepareInterval = 32;
+
+uint8_t large_buffer[kLargeBufferSize];
+uint8_t small_buffer[kSmallBufferSize];
+ShortFrame input[kBlockSize];
+ShortFrame output[kBlockSize];
+float float_input[kBlockSize * 2];
+float float_output[kBlockSize * 2];
+
+void InitParameters(Parameters* p) {
+  p->position = 0.5f;
+  p->size = 0.5f;
+  p->pitch = 7.0f;
+  p->density = 0.7f;
+  p->texture = 0.6f;
+  p->dry_wet = 1.0f;
+  p->stereo_spread = 0.5f;
+  p->feedback = 0.5f;
+  p->reverb = 0.5f;
+  p->freeze = false;
+  p->trigger = false;
+  p->gate = false;
+}
+
+// Time spent in Process(), in ns per frame, with 16-bit or float samples. The
+// fastest of several passes is kept.
+// When silent, the processor only converts the samples.
+double TimeProcessor(
+    PlaybackMode mode, int32_t quality, bool float_io, bool silent) {
+  GranularProcessor* processor = new GranularProcessor;
+  processor->Init(
+      large_buffer, sizeof(large_buffer),
+      small_buffer, sizeof(small_buffer),
+      kSampleRate);
+  processor->set_silence(silent);
+  processor->set_playback_mode(mode);
+  processor->set_quality(quality);
+  InitParameters(processor->mutable_parameters());
+  processor->Prepare();
+
+  double best = 0.0;
+  float phase = 0.0f;
+  for (size_t pass = 0; pass < kPasses; ++pass) {
+    double elapsed = 0.0;
+    for (size_t n = 0; n < kDuration; n += kBlockSize) {
+      for (size_t i = 0; i < kBlockSize; ++i) {
+        phase += 220.0f / kSampleRate;
+        if (phase >= 1.0f) {
+          phase -= 1.0f;
+        }
+        float x = 0.5f * sinf(phase * 2.0f * M_PI);
+        float_input[2 * i] = float_input[2 * i + 1] = x;
+        input[i].l = input[i].r = static_cast<short>(x * 32768.0f);
+      }
+      chrono::high_resolution_clock::time_point start = \
+          chrono::high_resolution_clock::now();
+      if (float_io) {
+        processor->Process(float_input, float_output, kBlockSize);
+      } else {
+        processor->Process(input, output, kBlockSize);
+      }
+      elapsed += chrono::duration<double, nano>(
+          chrono::high_resolution_clock::now() - start).count();
+      for (size_t i = 0; i < kBlockSize; i += kPrepareInterval) {
+        processor->Prepare();
+      }
+    }
+    if (pass == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  delete processor;
+  return best / kDuration;
+}
+
+// Time of a Process() call of only 2 frames, in ns, where the per-block
+// work done before and after the samples are processed dominates. The
+// parameters do not move.
+double TimeSmallBlocks(PlaybackMode mode) {
+  const size_t kCallSize = 2;
+  GranularProcessor* processor = new GranularProcessor;
+  processor->Init(
+      large_buffer, sizeof(large_buffer),
+      small_buffer, sizeof(small_buffer),
+      kSampleRate);
+  processor->set_playback_mode(mode);
+  processor->set_quality(0);
+  InitParameters(processor->mutable_parameters());
+  processor->Prepare();
+
+  double best = 0.0;
+  float phase = 0.0f;
+  for (size_t pass = 0; pass < kPasses; ++pass) {
+    double elapsed = 0.0;
+    for (size_t n = 0; n < kDuration; n += kBlockSize) {
+      for (size_t i = 0; i < kBlockSize; ++i) {
+        phase += 220.0f / kSampleRate;
+        if (phase >= 1.0f) {
+          phase -= 1.0f;
+        }
+        float x = 0.5f * sinf(phase * 2.0f * M_PI);
+        float_input[2 * i] = float_input[2 * i + 1] = x;
+      }
+      chrono::high_resolution_clock::time_point start = \
+          chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < kBlockSize; i += kCallSize) {
+        processor->Process(
+            &float_input[2 * i], &float_output[2 * i], kCallSize);
+      }
+      elapsed += chrono::duration<double, nano>(
+          chrono::high_resolution_clock::now() - start).count();
+      for (size_t i = 0; i < kBlockSize; i += kPrepareInterval) {
+        processor->Prepare();
+      }
+    }
+    if (pass == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  delete processor;
+  return best / (kDuration / kCallSize);
+}
+
+// Runs the processor with 32-frame render calls and no idle loop. Without a
+// budget, Prepare() is called at the end of each render call; with a budget,
+// the processor slices the deferred work itself. Prints the mean and the 99th
+// percentile of the time of a render call in us, and the backlog left at the
+// end in cycles. The maximum is not shown: on a desktop OS it mostly measures
+// the scheduler.
+void TimeBudget(PlaybackMode mode, size_t budget) {
+  const size_t kRenderSize = 32;
+  GranularProcessor* processor = new GranularProcessor;
+  processor->Init(
+      large_buffer, sizeof(large_buffer),
+      small_buffer, sizeof(small_buffer),
+      kSampleRate);
+  processor->set_playback_mode(mode);
+  processor->set_quality(0);
+  InitParameters(processor->mutable_parameters());
+  processor->Prepare();
+  processor->set_prepare_budget(budget);
+  
+  double total = 0.0;
+  vector<double> times;
+  float phase = 0.0f;
+  for (size_t n = 0; n < kDuration; n += kRenderSize) {
+    for (size_t i = 0; i < kRenderSize; ++i) {
+      phase += 220.0f / kSampleRate;
+      if (phase >= 1.0f) {
+        phase -= 1.0f;
+      }
+      float x = 0.5f * sinf(phase * 2.0f * M_PI);
+      float_input[2 * i] = float_input[2 * i + 1] = x;
+    }
+    chrono::high_resolution_clock::time_point start = \
+        chrono::high_resolution_clock::now();
+    processor->Process(float_input, float_output, kRenderSize);
+    if (!budget) {
+      processor->Prepare();
+    }
+    double elapsed = chrono::duration<double, micro>(
+        chrono::high_resolution_clock::now() - start).count();
+    total += elapsed;
+    // The first second, while the buffers fill up, is not counted.
+    if (n >= kSampleRate) {
+      times.push_back(elapsed);
+    }
+  }
+  sort(times.begin(), times.end());
+  printf(
+      "%-16s %8d %9.3f us %9.3f us %12d\n",
+      mode == PLAYBACK_MODE_SPECTRAL ? "Spectral" : "Stretch",
+      int(budget),
+      total / (kDuration / kRenderSize),
+      times[times.size() * 99 / 100],
+      int(processor->prepare_backlog()));
+  delete processor;
+}
+
+// Renders different signals on the left and right channels in stereo
+// spectral mode, once with a full Prepare() after each 32-frame call and once
+// with a budget large enough to do the same work in the call. Prints the
+// largest difference between the two outputs, which should be 0.
+void CheckBudgetStereo() {
+  const size_t kRenderSize = 32;
+  const size_t kCheckDuration = kSampleRate * 2;
+  vector<float> rendered[2];
+  for (int32_t pass = 0; pass < 2; ++pass) {
+    // Both passes start from the same buffers and random state.
+    memset(large_buffer, 0, sizeof(large_buffer));
+    memset(small_buffer, 0, sizeof(small_buffer));
+    stmlib::Random::Seed(0x21);
+    GranularProcessor* processor = new GranularProcessor;
+    processor->Init(
+        large_buffer, sizeof(large_buffer),
+        small_buffer, sizeof(small_buffer),
+        kSampleRate);
+    processor->set_playback_mode(PLAYBACK_MODE_SPECTRAL);
+    processor->set_quality(0);
+    InitParameters(processor->mutable_parameters());
+    processor->Prepare();
+    processor->set_prepare_budget(pass == 0 ? 0 : 1 << 30);
+    
+    float phase[2] = { 0.0f, 0.0f };
+    for (size_t n = 0; n < kCheckDuration; n += kRenderSize) {
+      for (size_t i = 0; i < kRenderSize; ++i) {
+        for (size_t c = 0; c < 2; ++c) {
+          phase[c] += (c ? 330.0f : 220.0f) / kSampleRate;
+          if (phase[c] >= 1.0f) {
+            phase[c] -= 1.0f;
+          }
+          float_input[2 * i + c] = c ? (phase[c] - 0.5f) * 0.5f
+              : 0.5f * sinf(phase[c] * 2.0f * M_PI);
+        }
+      }
+      processor->Process(float_input, float_output, kRenderSize);
+      if (pass == 0) {
+        processor->Prepare();
+      }
+      rendered[pass].insert(
+          rendered[pass].end(), float_output, float_output + 2 * kRenderSize);
+    }
+    delete processor;
+  }
+  float difference = 0.0f;
+  for (size_t i = 0; i < rendered[0].size(); ++i) {
+    difference = max(difference, fabsf(rendered[0][i] - rendered[1][i]));
+  }
+  printf("%-16s %12g\n", "Spectral", difference);
+}
+
+// Changes the playback mode after one second of audio, with Prepare() called
+// every prepare_interval frames as from a main loop. Prints, for the second
+// after the change, the longest run of silent output frames with DRY/WET at
+// 50% and at 100% in ms, the longest Prepare() call in us, and the mean time
+// of a 32-frame render call in us during the transition compared with before
+// the change. The transition is the overlap of the two players, or the fade
+// out and fade in around a change to or from the spectral mode.
+void TimeModeSwitch(PlaybackMode from, PlaybackMode to, size_t interval) {
+  const char* mode_names[] = {
+    "Granular", "Stretch", "Looping delay", "Spectral"
+  };
+  const size_t kRenderSize = 32;
+  bool staged = from == PLAYBACK_MODE_SPECTRAL || to == PLAYBACK_MODE_SPECTRAL;
+  size_t transition_frames = (staged ? 2 : 1) * \
+      kPlaybackModeFadeTime * kSampleRate;
+  double longest_gap[2];
+  double longest_prepare = 0.0;
+  double render_before = 0.0;
+  double render_during = 0.0;
+  for (int32_t pass = 0; pass < 2; ++pass) {
+    GranularProcessor* processor = new GranularProcessor;
+    processor->Init(
+        large_buffer, sizeof(large_buffer),
+        small_buffer, sizeof(small_buffer),
+        kSampleRate);
+    processor->set_playback_mode(from);
+    processor->set_quality(0);
+    InitParameters(processor->mutable_parameters());
+    processor->mutable_parameters()->dry_wet = pass == 0 ? 0.5f : 1.0f;
+    processor->Prepare();
+    
+    size_t gap = 0;
+    size_t longest = 0;
+    float phase = 0.0f;
+    for (size_t n = 0; n < 2 * kSampleRate; n += kRenderSize) {
+      if (n == kSampleRate) {
+        processor->set_playback_mode(to);
+      }
+      for (size_t i = 0; i < kRenderSize; ++i) {
+        phase += 220.0f / kSampleRate;
+        if (phase >= 1.0f) {
+          phase -= 1.0f;
+        }
+        float x = 0.5f * sinf(phase * 2.0f * M_PI);
+        float_input[2 * i] = float_input[2 * i + 1] = x;
+      }
+      chrono::high_resolution_clock::time_point start = \
+          chrono::high_resolution_clock::now();
+      processor->Process(float_input, float_output, kRenderSize);
+      double elapsed = chrono::duration<double, micro>(
+          chrono::high_resolution_clock::now() - start).count();
+      if (n >= kSampleRate - transition_frames && n < kSampleRate) {
+        render_before += elapsed;
+      } else if (n >= kSampleRate && n < kSampleRate + transition_frames) {
+        render_during += elapsed;
+      }
+      if (n >= kSampleRate) {
+        for (size_t i = 0; i < kRenderSize; ++i) {
+          bool silent = fabs(float_output[2 * i]) < 1e-4f &&
+              fabs(float_output[2 * i + 1]) < 1e-4f;
+          gap = silent ? gap + 1 : 0;
+          longest = max(longest, gap);
+        }
+      }
+      if ((n + kRenderSize) % interval == 0) {
+        start = chrono::high_resolution_clock::now();
+        processor->Prepare();
+        elapsed = chrono::duration<double, micro>(
+            chrono::high_resolution_clock::now() - start).count();
+        if (n >= kSampleRate) {
+          longest_prepare = max(longest_prepare, elapsed);
+        }
+      }
+    }
+    longest_gap[pass] = 1000.0 * longest / kSampleRate;
+    delete processor;
+  }
+  size_t num_renders = 2 * transition_frames / kRenderSize;
+  printf(
+      "%-13s > %-13s %5d %8.1f ms %8.1f ms %9.1f us %6.2f > %6.2f us\n",
+      mode_names[from],
+      mode_names[to],
+      int(interval),
+      longest_gap[0],
+      longest_gap[1],
+      longest_prepare,
+      render_before / num_renders,
+      render_during / num_renders);
+}
+
+// Changes the playback mode or the quality after one second of audio, in
+// 32-frame render calls with a budget and no idle loop. Prints the number of
+// calls during which the buffers were being reallocated, the longest call in
+// the half second before the change and the longest of these calls in us, and
+// the backlog left after the first of them in cycles. Each call is timed over
+// several runs and its shortest time is kept, so that the longest call shows
+// the work done in it rather than the scheduler.
+void TimeReallocation(
+    PlaybackMode from,
+    PlaybackMode to,
+    int32_t quality,
+    size_t budget) {
+  const char* mode_names[] = {
+    "Granular", "Stretch", "Looping delay", "Spectral"
+  };
+  const size_t kRenderSize = 32;
+  const int32_t kNumRuns = 5;
+  const size_t kNumCalls = 2 * kSampleRate / kRenderSize;
+  const size_t kChange = kSampleRate / kRenderSize;
+  vector<double> times(kNumCalls, 1e9);
+  vector<bool> reallocating(kNumCalls, false);
+  size_t backlog = 0;
+  for (int32_t run = 0; run < kNumRuns; ++run) {
+    GranularProcessor* processor = new GranularProcessor;
+    processor->Init(
+        large_buffer, sizeof(large_buffer),
+        small_buffer, sizeof(small_buffer),
+        kSampleRate);
+    processor->set_playback_mode(from);
+    processor->set_quality(0);
+    InitParameters(processor->mutable_parameters());
+    processor->Prepare();
+    processor->set_prepare_budget(budget);
+    
+    float phase = 0.0f;
+    for (size_t call = 0; call < kNumCalls; ++call) {
+      if (call == kChange) {
+        processor->set_playback_mode(to);
+        processor->set_quality(quality);
+      }
+      for (size_t i = 0; i < kRenderSize; ++i) {
+        phase += 220.0f / kSampleRate;
+        if (phase >= 1.0f) {
+          phase -= 1.0f;
+        }
+        float x = 0.5f * sinf(phase * 2.0f * M_PI);
+        float_input[2 * i] = float_input[2 * i + 1] = x;
+      }
+      bool before = processor->reallocating();
+      chrono::high_resolution_clock::time_point start = \
+          chrono::high_resolution_clock::now();
+      processor->Process(float_input, float_output, kRenderSize);
+      double elapsed = chrono::duration<double, micro>(
+          chrono::high_resolution_clock::now() - start).count();
+      times[call] = min(times[call], elapsed);
+      if (!before && processor->reallocating()) {
+        backlog = processor->prepare_backlog();
+      }
+      if (before || processor->reallocating()) {
+        reallocating[call] = true;
+      }
+    }
+    delete processor;
+  }
+  size_t num_calls = 0;
+  double longest = 0.0;
+  for (size_t call = kChange; call < kNumCalls; ++call) {
+    if (reallocating[call]) {
+      ++num_calls;
+      longest = max(longest, times[call]);
+    }
+  }
+  char name[32];
+  if (from == to) {
+    snprintf(name, sizeof(name), "%s, quality %d", mode_names[to], quality);
+  } else {
+    snprintf(name, sizeof(name), "%s", mode_names[to]);
+  }
+  printf(
+      "%-13s > %-20s %8d %6d %9.1f us %9.1f us %10d\n",
+      mode_names[from],
+      name,
+      int(budget),
+      int(num_calls),
+      *max_element(times.begin() + kChange / 2, times.begin() + kChange),
+      longest,
+      int(backlog));
+}
+
+int main(void) {
+  const char* mode_names[] = {
+    "Granular", "Stretch", "Looping delay", "Spectral"
+  };
+  printf("\nGranularProcessor, %d-frame inner blocks, ", int(kMaxBlockSize));
+  printf("time per frame in ns,\nwith 16-bit and float samples.\n");
+  printf(
+      "%-16s %12s %12s %12s %12s\n",
+      "", "hi-fi 16-bit", "hi-fi float", "lo-fi 16-bit", "lo-fi float");
+  for (int32_t mode = 0; mode < PLAYBACK_MODE_LAST; ++mode) {
+    PlaybackMode m = static_cast<PlaybackMode>(mode);
+    printf(
+        "%-16s %9.3f ns %9.3f ns %9.3f ns %9.3f ns\n",
+        mode_names[mode],
+        TimeProcessor(m, 0, false, false),
+        TimeProcessor(m, 0, true, false),
+        TimeProcessor(m, 2, false, false),
+        TimeProcessor(m, 2, true, false));
+  }
+  printf(
+      "%-16s %9.3f ns %9.3f ns\n",
+      "Silent",
+      TimeProcessor(PLAYBACK_MODE_GRANULAR, 0, false, true),
+      TimeProcessor(PLAYBACK_MODE_GRANULAR, 0, true, true));
+  
+  printf("\nTime of a 2-frame float call in ns, hi-fi.\n");
+  for (int32_t mode = 0; mode < PLAYBACK_MODE_LAST; ++mode) {
+    printf(
+        "%-16s %9.3f ns\n",
+        mode_names[mode],
+        TimeSmallBlocks(static_cast<PlaybackMode>(mode)));
+  }
+  
+  printf("\nDeferred work done in 32-frame render calls, with a budget in ");
+  printf("cycles, or\nwith a full Prepare() after each call. Mean and 99th ");
+  printf("percentile of the time\nof a call, backlog left at the end in ");
+  printf("cycles.\n");
+  printf(
+      "%-16s %8s %12s %12s %12s\n", "", "budget", "mean", "p99",
+      "backlog");
+  const size_t budgets[] = { 0, 20000, 60000 };
+  for (size_t i = 0; i < 3; ++i) {
+    TimeBudget(PLAYBACK_MODE_SPECTRAL, budgets[i]);
+  }
+  for (size_t i = 0; i < 3; ++i) {
+    TimeBudget(PLAYBACK_MODE_STRETCH, budgets[i]);
+  }
+  
+  printf("\nStereo spectral output with a budget, largest difference with ");
+  printf("full Prepare()\ncalls.\n");
+  CheckBudgetStereo();
+  
+  printf("\nChanges of playback mode, with Prepare() called every N frames. ");
+  printf("Longest silence\nafter the change with DRY/WET at 50%% and ");
+  printf("100%%, longest Prepare() call, mean\ntime of a 32-frame call ");
+  printf("before and during the transition.\n");
+  printf(
+      "%-29s %5s %11s %11s %12s %16s\n", "", "N", "gap 50%", "gap 100%",
+      "Prepare", "render");
+  const size_t intervals[] = { 32, 512 };
+  for (size_t i = 0; i < 2; ++i) {
+    TimeModeSwitch(
+        PLAYBACK_MODE_GRANULAR, PLAYBACK_MODE_SPECTRAL, intervals[i]);
+    TimeModeSwitch(
+        PLAYBACK_MODE_SPECTRAL, PLAYBACK_MODE_GRANULAR, intervals[i]);
+    TimeModeSwitch(
+        PLAYBACK_MODE_LOOPING_DELAY, PLAYBACK_MODE_STRETCH, intervals[i]);
+    TimeModeSwitch(
+        PLAYBACK_MODE_STRETCH, PLAYBACK_MODE_GRANULAR, intervals[i]);
+  }
+  
+  printf("\nReallocation of the buffers in 32-frame render calls, with a ");
+  printf("budget in cycles.\nCalls spent reallocating, longest call before ");
+  printf("the change and while\nreallocating, backlog after the first of ");
+  printf("these calls in cycles.\n");
+  printf(
+      "%-36s %8s %6s %12s %12s %10s\n", "", "budget", "calls", "before",
+      "during", "backlog");
+  const size_t small_budgets[] = { 5000, 20000 };
+  for (size_t i = 0; i < 2; ++i) {
+    TimeReallocation(
+        PLAYBACK_MODE_GRANULAR, PLAYBACK_MODE_SPECTRAL, 0, small_budgets[i]);
+    TimeReallocation(
+        PLAYBACK_MODE_SPECTRAL, PLAYBACK_MODE_GRANULAR, 0, small_budgets[i]);
+    TimeReallocation(
+        PLAYBACK_MODE_GRANULAR, PLAYBACK_MODE_GRANULAR, 1, small_budgets[i]);
+  }
+}
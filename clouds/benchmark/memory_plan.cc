@@ -0,0 +1,65 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Report of the memory plan of the granular processor on the module: for each
+// number of channels and playback mode, the memory used and wasted, and the
+// recording time or number of spectral textures.
+
+#include <cstdio>
+
+#include "clouds/dsp/granular_processor.h"
+
+using namespace clouds;
+
+int main(void) {
+  const char* mode_names[] = { "granular", "stretch", "looping", "spectral" };
+  const size_t total_size = kLargeBufferSize + kSmallBufferSize;
+  printf("Memory: %d + %d bytes; FX workspace: %d bytes\n\n",
+         int(kLargeBufferSize), int(kSmallBufferSize),
+         int(FxWorkspace::size));
+  printf("%-8s %-9s %8s %8s %7s  %s\n",
+         "channels", "mode", "used", "wasted", "wasted", "capacity");
+  for (int32_t num_channels = 1; num_channels <= 2; ++num_channels) {
+    MemoryPlan plan(kLargeBufferSize, kSmallBufferSize, num_channels);
+    for (int32_t i = 0; i < PLAYBACK_MODE_LAST; ++i) {
+      uint32_t regions = MemoryRegions(static_cast<PlaybackMode>(i));
+      size_t wasted = plan.wasted_size(regions);
+      printf("%-8d %-9s %8d %8d %6.1f%%  ",
+             int(num_channels), mode_names[i],
+             int(plan.size(regions)), int(wasted),
+             100.0f * wasted / total_size);
+      if (i == PLAYBACK_MODE_SPECTRAL) {
+        printf("%d textures\n", int(plan.num_textures()));
+      } else {
+        // 16-bit and 8-bit recording.
+        printf("%.2f s / %.2f s\n",
+               plan.sample_size() / 2 / kNativeSampleRate,
+               plan.sample_size() / kNativeSampleRate);
+      }
+    }
+  }
+  return 0;
+}
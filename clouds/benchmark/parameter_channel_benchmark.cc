@@ -0,0 +1,188 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host benchmark for the parameter channel: cost of one publish and one
+// acquire per block, and number of torn snapshots seen by a reader thread,
+// compared with a structure shared without protection.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "clouds/dsp/parameter_channel.h"
+#include "clouds/dsp/parameters.h"
+
+using namespace clouds;
+using namespace std;
+
+const size_t kNumBlocks = 10000000;
+const double kStressDuration = 1.0;
+
+// Prevents the compiler from optimizing away benchmarked computations.
+volatile float sink;
+
+// Snapshots written by the tests have all their fields set to the same value,
+// so that a torn one can be recognized.
+template<typename P>
+void Fill(P* p, float value) {
+  p->position = value;
+  p->size = value;
+  p->pitch = value;
+  p->density = value;
+  p->texture = value;
+  p->dry_wet = value;
+  p->stereo_spread = value;
+  p->feedback = value;
+  p->reverb = value;
+  p->granular.overlap = value;
+  p->granular.window_shape = value;
+  p->granular.stereo_spread = value;
+  p->spectral.quantization = value;
+  p->spectral.refresh_rate = value;
+  p->spectral.phase_randomization = value;
+  p->spectral.warp = value;
+}
+
+template<typename P>
+bool Torn(const P& p) {
+  float v = p.position;
+  return p.size != v || p.pitch != v || p.density != v || p.texture != v ||
+      p.dry_wet != v || p.stereo_spread != v || p.feedback != v ||
+      p.reverb != v || p.granular.overlap != v ||
+      p.granular.window_shape != v || p.granular.stereo_spread != v ||
+      p.spectral.quantization != v || p.spectral.refresh_rate != v ||
+      p.spectral.phase_randomization != v || p.spectral.warp != v;
+}
+
+double Elapsed(chrono::high_resolution_clock::time_point start) {
+  return chrono::duration<double, nano>(
+      chrono::high_resolution_clock::now() - start).count();
+}
+
+// Time per block, in ns, of a publish followed by an acquire on the same
+// thread, and of an acquire when nothing new has been published.
+void TimeChannel(double* publish_acquire, double* acquire_only) {
+  ParameterChannel<Parameters> channel;
+  Parameters written, read;
+  Fill(&written, 0.0f);
+  Fill(&read, 0.0f);
+  channel.Init(written);
+  
+  chrono::high_resolution_clock::time_point start = \
+      chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < kNumBlocks; ++i) {
+    written.position = static_cast<float>(i);
+    channel.Publish(written);
+    channel.Acquire(&read);
+    sink = read.position;
+  }
+  *publish_acquire = Elapsed(start) / kNumBlocks;
+  
+  start = chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < kNumBlocks; ++i) {
+    channel.Acquire(&read);
+    sink = read.position;
+  }
+  *acquire_only = Elapsed(start) / kNumBlocks;
+}
+
+// A writer thread publishes snapshots as fast as it can, while the reader
+// acquires them. Counts the snapshots acquired, and the torn ones. On a single
+// core, the reader gets at most one new snapshot per time slice.
+void StressChannel(size_t* acquired, size_t* torn) {
+  ParameterChannel<Parameters> channel;
+  Parameters p;
+  Fill(&p, 0.0f);
+  channel.Init(p);
+  
+  atomic<bool> done(false);
+  thread writer([&channel, &done]() {
+    Parameters w;
+    float value = 0.0f;
+    while (!done.load(memory_order_relaxed)) {
+      value += 1.0f;
+      Fill(&w, value);
+      channel.Publish(w);
+    }
+  });
+  
+  *acquired = *torn = 0;
+  chrono::high_resolution_clock::time_point start = \
+      chrono::high_resolution_clock::now();
+  while (Elapsed(start) < kStressDuration * 1e9) {
+    if (channel.Acquire(&p)) {
+      ++*acquired;
+      *torn += Torn(p) ? 1 : 0;
+    }
+  }
+  done.store(true, memory_order_relaxed);
+  writer.join();
+}
+
+// Same, with the structure written and read field by field. Every read is
+// counted.
+void StressShared(size_t* acquired, size_t* torn) {
+  static volatile Parameters shared;
+  Fill(&shared, 0.0f);
+  
+  atomic<bool> done(false);
+  thread writer([&done]() {
+    float value = 0.0f;
+    while (!done.load(memory_order_relaxed)) {
+      value += 1.0f;
+      Fill(&shared, value);
+    }
+  });
+  
+  *acquired = *torn = 0;
+  chrono::high_resolution_clock::time_point start = \
+      chrono::high_resolution_clock::now();
+  while (Elapsed(start) < kStressDuration * 1e9) {
+    ++*acquired;
+    *torn += Torn(shared) ? 1 : 0;
+  }
+  done.store(true, memory_order_relaxed);
+  writer.join();
+}
+
+int main(void) {
+  double publish_acquire, acquire_only;
+  TimeChannel(&publish_acquire, &acquire_only);
+  printf("\nParameterChannel<Parameters>, %d bytes per snapshot.\n",
+         int(sizeof(Parameters)));
+  printf("%-24s %9.3f ns per block\n", "Publish + acquire", publish_acquire);
+  printf("%-24s %9.3f ns per block\n", "Acquire, nothing new", acquire_only);
+  
+  size_t acquired, torn;
+  printf("\nSnapshots read by one thread while another writes them.\n");
+  StressChannel(&acquired, &torn);
+  printf("%-24s %12d read %12d torn\n", "Channel", int(acquired), int(torn));
+  StressShared(&acquired, &torn);
+  printf("%-24s %12d read %12d torn\n", "Shared, unprotected",
+         int(acquired), int(torn));
+  return 0;
+}
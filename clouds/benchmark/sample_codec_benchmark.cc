@@ -0,0 +1,275 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Compression ratio and throughput of the codec of the saved sample memory.
+// Each recording is played through the granular processor until its buffers
+// are full, then saved to a simulated flash sector and loaded back. The
+// recordings are 16-bit WAV files given on the command line, or synthetic
+// signals.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "clouds/dsp/granular_processor.h"
+#include "stmlib/utils/random.h"
+
+using namespace clouds;
+using namespace std;
+
+const size_t kSampleRate = 32000;
+const size_t kBlockSize = 32;
+const size_t kFlashSectorSize = 0x20000;
+
+// Typical time to program a word of flash on a STM32F4.
+const double kFlashWordProgrammingTime = 16e-6;
+
+uint8_t large_buffer[kLargeBufferSize];
+uint8_t small_buffer[kSmallBufferSize];
+uint32_t flash[kFlashSectorSize / sizeof(uint32_t)];
+
+class RamWriter {
+ public:
+  RamWriter() { }
+  ~RamWriter() { }
+  
+  void Init(uint32_t* address, uint32_t* end) {
+    address_ = address;
+    end_ = end;
+  }
+  
+  inline void Write(uint32_t word) {
+    if (address_ < end_) {
+      *address_ = word;
+    }
+    ++address_;
+  }
+  
+  inline uint32_t* address() const { return address_; }
+  
+ private:
+  uint32_t* address_;
+  uint32_t* end_;
+  
+  DISALLOW_COPY_AND_ASSIGN(RamWriter);
+};
+
+struct Recording {
+  const char* name;
+  vector<float> samples;  // Interleaved stereo.
+};
+
+bool ReadWav(const char* file_name, Recording* recording) {
+  FILE* fp = fopen(file_name, "rb");
+  if (!fp) {
+    return false;
+  }
+  char riff[12];
+  uint16_t format = 0;
+  uint16_t num_channels = 0;
+  uint16_t bits = 0;
+  bool ok = fread(riff, 1, 12, fp) == 12 && !memcmp(riff, "RIFF", 4) &&
+      !memcmp(riff + 8, "WAVE", 4);
+  while (ok) {
+    char id[4];
+    uint32_t size;
+    ok = fread(id, 1, 4, fp) == 4 && fread(&size, 4, 1, fp) == 1;
+    if (ok && !memcmp(id, "fmt ", 4)) {
+      uint8_t fmt[16];
+      ok = size >= 16 && fread(fmt, 1, 16, fp) == 16;
+      memcpy(&format, &fmt[0], 2);
+      memcpy(&num_channels, &fmt[2], 2);
+      memcpy(&bits, &fmt[14], 2);
+      fseek(fp, size - 16 + (size & 1), SEEK_CUR);
+    } else if (ok && !memcmp(id, "data", 4)) {
+      ok = format == 1 && bits == 16 && num_channels >= 1 &&
+          num_channels <= 2;
+      if (ok) {
+        vector<int16_t> pcm(size / 2);
+        size_t num_frames = fread(&pcm[0], 2, pcm.size(), fp) / num_channels;
+        recording->samples.resize(num_frames * 2);
+        for (size_t i = 0; i < num_frames; ++i) {
+          int16_t l = pcm[i * num_channels];
+          int16_t r = pcm[i * num_channels + num_channels - 1];
+          recording->samples[2 * i] = l / 32768.0f;
+          recording->samples[2 * i + 1] = r / 32768.0f;
+        }
+      }
+      break;
+    } else if (ok) {
+      fseek(fp, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fclose(fp);
+  recording->name = file_name;
+  return ok;
+}
+
+void Synthesize(const char* name, Recording* recording) {
+  const size_t kDuration = kSampleRate * 4;
+  recording->name = name;
+  recording->samples.resize(kDuration * 2);
+  float phase = 0.0f;
+  for (size_t i = 0; i < kDuration; ++i) {
+    float t = static_cast<float>(i) / kSampleRate;
+    float noise = stmlib::Random::GetFloat() * 2.0f - 1.0f;
+    float l = 0.0f;
+    float r = 0.0f;
+    if (!strcmp(name, "sine")) {
+      phase += 220.0f / kSampleRate;
+      l = r = 0.5f * sinf(phase * 2.0f * M_PI);
+    } else if (!strcmp(name, "plucks")) {
+      // A note every 250ms, 5 decaying harmonics.
+      float note_t = fmodf(t, 0.25f);
+      float f = 110.0f * (1 + (static_cast<int32_t>(t * 4.0f) % 3));
+      for (int32_t h = 1; h <= 5; ++h) {
+        l += sinf(2.0f * M_PI * f * h * note_t) / h;
+      }
+      l *= 0.3f * expf(-note_t * 12.0f);
+      r = l;
+    } else if (!strcmp(name, "quiet noise")) {
+      l = 0.01f * noise;
+      r = 0.01f * (stmlib::Random::GetFloat() * 2.0f - 1.0f);
+    } else if (!strcmp(name, "loud noise")) {
+      l = 0.9f * noise;
+      r = 0.9f * (stmlib::Random::GetFloat() * 2.0f - 1.0f);
+    }
+    recording->samples[2 * i] = l;
+    recording->samples[2 * i + 1] = r;
+  }
+}
+
+bool Benchmark(const Recording& recording, int32_t quality) {
+  GranularProcessor* processor = new GranularProcessor;
+  memset(large_buffer, 0, sizeof(large_buffer));
+  memset(small_buffer, 0, sizeof(small_buffer));
+  processor->Init(
+      large_buffer, sizeof(large_buffer),
+      small_buffer, sizeof(small_buffer),
+      kSampleRate);
+  processor->set_playback_mode(PLAYBACK_MODE_GRANULAR);
+  processor->set_quality(quality);
+  processor->Prepare();
+  
+  // Record until the buffers are full, looping the recording if needed.
+  MemoryPlan plan(kLargeBufferSize, kSmallBufferSize, 2 - (quality & 1));
+  size_t sample_size = plan.sample_size();
+  size_t num_frames = sample_size / (quality >> 1 ? 1 : 2);
+  size_t length = recording.samples.size() / 2;
+  vector<float> output(kBlockSize * 2);
+  for (size_t n = 0; n < num_frames + kBlockSize; n += kBlockSize) {
+    processor->Process(
+        &recording.samples[2 * (n % (length - length % kBlockSize))],
+        &output[0],
+        kBlockSize);
+    processor->Prepare();
+  }
+  
+  PersistentBlock blocks[4];
+  size_t num_blocks;
+  processor->PreparePersistentData();
+  processor->GetPersistentData(blocks, &num_blocks);
+  size_t raw_size = 0;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    raw_size += 8 + blocks[i].size;
+  }
+  
+  vector<uint8_t> large_copy(large_buffer, large_buffer + sample_size);
+  vector<uint8_t> small_copy(small_buffer, small_buffer + sample_size);
+  
+  RamWriter writer;
+  writer.Init(flash, flash + sizeof(flash) / sizeof(uint32_t));
+  chrono::high_resolution_clock::time_point start = \
+      chrono::high_resolution_clock::now();
+  WritePersistentBlocks(blocks, num_blocks, &writer);
+  double save_time = chrono::duration<double>(
+      chrono::high_resolution_clock::now() - start).count();
+  size_t saved_size = (writer.address() - flash) * sizeof(uint32_t);
+  
+  memset(large_buffer, 0x55, sample_size);
+  memset(small_buffer, 0x55, sample_size);
+  start = chrono::high_resolution_clock::now();
+  bool loaded = processor->LoadPersistentData(flash);
+  double load_time = chrono::duration<double>(
+      chrono::high_resolution_clock::now() - start).count();
+  bool identical = loaded &&
+      !memcmp(&large_copy[0], large_buffer, sample_size) &&
+      (quality & 1 || !memcmp(&small_copy[0], small_buffer, sample_size));
+  
+  const char* quality_names[] = {
+    "16-bit stereo", "16-bit mono", "mu-law stereo", "mu-law mono"
+  };
+  printf(
+      "%-24s %-14s %7d %7d %6.2f %8.1f %8.1f %7.0f %7.0f %s\n",
+      recording.name, quality_names[quality],
+      int(raw_size), int(saved_size),
+      static_cast<double>(raw_size) / saved_size,
+      raw_size / save_time / 1e6,
+      raw_size / load_time / 1e6,
+      raw_size / 4 * kFlashWordProgrammingTime * 1e3,
+      saved_size / 4 * kFlashWordProgrammingTime * 1e3,
+      saved_size > kFlashSectorSize ? "OVERFLOW" : identical ? "ok" : "FAIL");
+  delete processor;
+  return identical && saved_size <= kFlashSectorSize;
+}
+
+int main(int argc, char** argv) {
+  vector<Recording> recordings;
+  for (int32_t i = 1; i < argc; ++i) {
+    Recording recording;
+    if (!ReadWav(argv[i], &recording) || recording.samples.size() < 256) {
+      fprintf(stderr, "Cannot read %s as a 16-bit WAV file\n", argv[i]);
+      return 1;
+    }
+    recordings.push_back(recording);
+  }
+  if (recordings.empty()) {
+    const char* names[] = {
+      "silence", "sine", "plucks", "quiet noise", "loud noise"
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+      Recording recording;
+      Synthesize(names[i], &recording);
+      recordings.push_back(recording);
+    }
+  }
+  
+  printf("Sizes in bytes, codec throughput in MB/s of raw data, estimated\n");
+  printf("flash programming times in ms.\n\n");
+  printf(
+      "%-24s %-14s %7s %7s %6s %8s %8s %7s %7s\n",
+      "recording", "quality", "raw", "saved", "ratio", "save", "load",
+      "t raw", "t saved");
+  int32_t failures = 0;
+  for (size_t i = 0; i < recordings.size(); ++i) {
+    for (int32_t quality = 0; quality < 4; ++quality) {
+      failures += Benchmark(recordings[i], quality) ? 0 : 1;
+    }
+  }
+  return failures ? 1 : 0;
+}
@@ -48,8 +48,8 @@ Settings settings;
 Ui ui;
 
 // Pre-allocate big blocks in main memory and CCM. No malloc here.
-uint8_t block_mem[118784];
-uint8_t block_ccm[65536 - 128] __attribute__ ((section (".ccmdata")));
+uint8_t block_mem[kLargeBufferSize];
+uint8_t block_ccm[kSmallBufferSize] __attribute__ ((section (".ccmdata")));
 
 int __errno;
 
@@ -104,7 +104,8 @@ void Init() {
   // Init granular processor.
   processor.Init(
       block_mem, sizeof(block_mem),
-      block_ccm, sizeof(block_ccm));
+      block_ccm, sizeof(block_ccm),
+      kNativeSampleRate);
 
   settings.Init();
   cv_scaler.Init(settings.mutable_calibration_data());
@@ -36,6 +36,7 @@
 #include "stmlib/dsp/dsp.h"
 #include "stmlib/utils/dsp.h"
 
+#include "clouds/dsp/interpolation.h"
 #include "clouds/dsp/mu_law.h"
 
 const int32_t kCrossFadeSize = 256;
@@ -50,18 +51,14 @@ enum Resolution {
   RESOLUTION_8_BIT_MU_LAW,
 };
 
-enum InterpolationMethod {
-  INTERPOLATION_ZOH,
-  INTERPOLATION_LINEAR,
-  INTERPOLATION_HERMITE
-};
-
 template<Resolution resolution>
 class AudioBuffer {
  public:
   AudioBuffer() { }
   ~AudioBuffer() { }
   
+  // The buffer is not cleared: it must already be filled with silence()
+  // bytes.
   void Init(
       void* buffer,
       int32_t size,
@@ -72,17 +69,14 @@ class AudioBuffer {
     write_head_ = 0;
     quantization_error_ = 0.0f;
     crossfade_counter_ = 0;
-    if (resolution == RESOLUTION_16_BIT) {
-      std::fill(&s16_[0], &s16_[size], 0);
-    } else {
-      std::fill(
-          &s8_[0],
-          &s8_[size],
-          resolution == RESOLUTION_8_BIT_MU_LAW ? 127 : 0);
-    }
     tail_ = tail_buffer;
   }
   
+  // Value of the bytes of a silent buffer.
+  static inline uint8_t silence() {
+    return resolution == RESOLUTION_8_BIT_MU_LAW ? 127 : 0;
+  }
+  
   inline void Resync(int32_t head) {
     write_head_ = head;
     crossfade_counter_ = 0;
@@ -56,7 +56,24 @@ class Correlator {
     }
   }
 
+  // Evaluates candidates until about budget cycles have been spent, and
+  // returns the estimated number of cycles spent. At least one candidate is
+  // evaluated when the search is not over.
+  inline size_t EvaluateCandidates(size_t budget) {
+    size_t cost = 0;
+    while (!done_ && cost < budget) {
+      EvaluateNextCandidate();
+      cost += candidate_cost();
+    }
+    return cost;
+  }
+
   void EvaluateNextCandidate();
+  
+  // Estimated cost, in cycles, of the candidates left to evaluate.
+  inline size_t backlog() const {
+    return done_ ? 0 : (size_ - candidate_) * candidate_cost();
+  }
 
   inline uint32_t* source() { return source_; }
   inline uint32_t* destination() { return destination_; }
@@ -65,6 +82,11 @@ class Correlator {
   inline bool done() { return done_; }
   
  private:
+  // Rough figure for a Cortex-M7: about 12 cycles per word of 32 samples.
+  inline size_t candidate_cost() const {
+    return (size_ >> 5) * 12 + 16;
+  }
+  
   uint32_t* source_;
   uint32_t* destination_;
   
@@ -31,10 +31,36 @@
 
 #include "clouds//stmlib/stmlib.h"
 
+#include <cmath>
+
 namespace clouds {
 
 const int32_t kMaxNumChannels = 2;
-const size_t kMaxBlockSize = 32;
+// Audio is processed in blocks of at most kMaxBlockSize frames; longer
+// buffers are split. The block size can be set at compile time.
+#ifndef CLOUDS_MAX_BLOCK_SIZE
+#define CLOUDS_MAX_BLOCK_SIZE 32
+#endif  // CLOUDS_MAX_BLOCK_SIZE
+
+const size_t kMaxBlockSize = CLOUDS_MAX_BLOCK_SIZE;
+
+// Low fidelity mode processes half blocks at half the sample rate.
+STATIC_ASSERT(kMaxBlockSize % 2 == 0, block_size_must_be_even);
+
+// Sample rate of the module. Lookup tables, filter and LFO frequencies and
+// decay times are designed for this rate, and rescaled at init when running
+// at another rate. Delay lengths in samples are not.
+const float kNativeSampleRate = 32000.0f;
+
+// The smoothers updated once per block were tuned for blocks of 32 frames at
+// kNativeSampleRate. Returns the coefficient giving the same time constant
+// with blocks of kMaxBlockSize frames at sample_rate. To be computed at init
+// time.
+inline float BlockCoefficient(float coefficient, float sample_rate) {
+  return static_cast<float>(1.0 - pow(
+      1.0 - coefficient,
+      kMaxBlockSize / 32.0 * kNativeSampleRate / sample_rate));
+}
 
 typedef struct { short l; short r; } ShortFrame;
 typedef struct { float l; float r; } FloatFrame;
@@ -0,0 +1,291 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Runs several identical instances of an FxEngine program at once. The delay
+// memory of all instances is interleaved sample by sample, so that each
+// instruction of the program processes all instances (lanes) with a few
+// vector operations. All lanes share the same coefficients and LFOs.
+
+#ifndef CLOUDS_DSP_FX_BATCH_FX_ENGINE_H_
+#define CLOUDS_DSP_FX_BATCH_FX_ENGINE_H_
+
+#include <algorithm>
+#include <cassert>
+
+#include "stmlib/stmlib.h"
+
+#include "stmlib/dsp/dsp.h"
+
+#include "clouds/dsp/fx/fx_engine.h"
+
+namespace clouds {
+
+template<size_t size, size_t lanes, size_t num_lfos = 2>
+class BatchFxEngine {
+ public:
+  // The delay lines are laid out as in a single instance engine.
+  typedef FxEngine<size, FORMAT_32_BIT, num_lfos> Layout;
+  typedef typename Layout::Empty Empty;
+  
+  enum {
+    buffer_size = size * lanes
+  };
+  
+  BatchFxEngine() { }
+  ~BatchFxEngine() { }
+
+  void Init(float* buffer) {
+    buffer_ = buffer;
+    lfos_.Init();
+    Clear();
+  }
+  
+  void Clear() {
+    std::fill(&buffer_[0], &buffer_[buffer_size], 0.0f);
+    write_ptr_ = 0;
+  }
+  
+  template<int32_t l, typename T = Empty>
+  struct Reserve : public Layout::template Reserve<l, T> { };
+  
+  template<typename Memory, int32_t index>
+  struct DelayLine : public Layout::template DelayLine<Memory, index> { };
+  
+  // Same as FxEngine::Context, except that values exchanged with the caller
+  // are arrays with one element per lane.
+  class Context {
+   friend class BatchFxEngine;
+   public:
+    Context() { }
+    ~Context() { }
+    
+    inline void Load(const float* value) {
+      for (size_t i = 0; i < lanes; ++i) {
+        accumulator_[i] = value[i];
+      }
+    }
+
+    inline void Read(const float* value, float scale) {
+      for (size_t i = 0; i < lanes; ++i) {
+        accumulator_[i] += value[i] * scale;
+      }
+    }
+
+    inline void Read(const float* value) {
+      for (size_t i = 0; i < lanes; ++i) {
+        accumulator_[i] += value[i];
+      }
+    }
+
+    inline void Write(float* value) {
+      for (size_t i = 0; i < lanes; ++i) {
+        value[i] = accumulator_[i];
+      }
+    }
+
+    inline void Write(float* value, float scale) {
+      for (size_t i = 0; i < lanes; ++i) {
+        value[i] = accumulator_[i];
+        accumulator_[i] *= scale;
+      }
+    }
+    
+    template<typename D>
+    inline void Write(D& d, int32_t offset, float scale) {
+      STATIC_ASSERT(D::base + D::length <= size, delay_memory_full);
+      FX_ENGINE_COUNT(writes, lanes);
+      FX_ENGINE_COUNT(bytes, lanes * sizeof(float));
+      FX_ENGINE_COUNT(compressions, lanes);
+      float* w = Frame(write_ptr_ + D::base + (offset == -1
+          ? D::length - 1
+          : offset));
+      for (size_t i = 0; i < lanes; ++i) {
+        w[i] = accumulator_[i];
+        accumulator_[i] *= scale;
+      }
+    }
+    
+    template<typename D>
+    inline void Write(D& d, float scale) {
+      Write(d, 0, scale);
+    }
+
+    template<typename D>
+    inline void WriteAllPass(D& d, int32_t offset, float scale) {
+      Write(d, offset, scale);
+      for (size_t i = 0; i < lanes; ++i) {
+        accumulator_[i] += previous_read_[i];
+      }
+    }
+    
+    template<typename D>
+    inline void WriteAllPass(D& d, float scale) {
+      WriteAllPass(d, 0, scale);
+    }
+    
+    template<typename D>
+    inline void Read(D& d, int32_t offset, float scale) {
+      STATIC_ASSERT(D::base + D::length <= size, delay_memory_full);
+      FX_ENGINE_COUNT(reads, lanes);
+      FX_ENGINE_COUNT(bytes, lanes * sizeof(float));
+      FX_ENGINE_COUNT(decompressions, lanes);
+      const float* r = Frame(write_ptr_ + D::base + (offset == -1
+          ? D::length - 1
+          : offset));
+      for (size_t i = 0; i < lanes; ++i) {
+        previous_read_[i] = r[i];
+        accumulator_[i] += r[i] * scale;
+      }
+    }
+    
+    template<typename D>
+    inline void Read(D& d, float scale) {
+      Read(d, 0, scale);
+    }
+    
+    // Reads each lane at its own offset, in [0, D::length). This allows a
+    // lane to use a shorter delay than the length reserved for the line.
+    template<typename D>
+    inline void Read(D& d, const int32_t* offset, float scale) {
+      STATIC_ASSERT(D::base + D::length <= size, delay_memory_full);
+      FX_ENGINE_COUNT(reads, lanes);
+      FX_ENGINE_COUNT(bytes, lanes * sizeof(float));
+      FX_ENGINE_COUNT(decompressions, lanes);
+      for (size_t i = 0; i < lanes; ++i) {
+        assert(offset[i] >= 0 && offset[i] < static_cast<int32_t>(D::length));
+        float r = Frame(write_ptr_ + D::base + offset[i])[i];
+        previous_read_[i] = r;
+        accumulator_[i] += r * scale;
+      }
+    }
+    
+    // Crossfades the content of the accumulator into value, with the same
+    // result as Write(wet, 0.0f) followed by value += amount * (wet - value).
+    inline void Crossfade(float* value, float amount) {
+      for (size_t i = 0; i < lanes; ++i) {
+        value[i] += amount * (accumulator_[i] - value[i]);
+        accumulator_[i] *= 0.0f;
+      }
+    }
+    
+    inline void Lp(float* state, float coefficient) {
+      for (size_t i = 0; i < lanes; ++i) {
+        state[i] += coefficient * (accumulator_[i] - state[i]);
+        accumulator_[i] = state[i];
+      }
+    }
+
+    inline void Hp(float* state, float coefficient) {
+      for (size_t i = 0; i < lanes; ++i) {
+        state[i] += coefficient * (accumulator_[i] - state[i]);
+        accumulator_[i] -= state[i];
+      }
+    }
+    
+    template<typename D>
+    inline void Interpolate(D& d, float offset, float scale) {
+      STATIC_ASSERT(D::base + D::length <= size, delay_memory_full);
+      FX_ENGINE_COUNT(interpolations, lanes);
+      FX_ENGINE_COUNT(reads, 2 * lanes);
+      FX_ENGINE_COUNT(bytes, 2 * lanes * sizeof(float));
+      FX_ENGINE_COUNT(decompressions, 2 * lanes);
+      MAKE_INTEGRAL_FRACTIONAL(offset);
+      const int32_t index = write_ptr_ + offset_integral + D::base;
+      const float* x0 = Frame(index);
+      const float* x1 = Frame(index + 1);
+      const float t = offset_fractional;
+      for (size_t i = 0; i < lanes; ++i) {
+        float x = x0[i] + (x1[i] - x0[i]) * t;
+        previous_read_[i] = x;
+        accumulator_[i] += x * scale;
+      }
+    }
+    
+    template<typename D>
+    inline void Interpolate(
+        D& d, float offset, LFOIndex index, float amplitude, float scale) {
+      FX_ENGINE_COUNT(lfo_evaluations, 1);
+      Interpolate(d, offset + amplitude * lfo_value_[index], scale);
+    }
+    
+   private:
+    // Indices are in [-size, 2 * size): a modulated interpolation can reach
+    // below the write pointer. A power of two size is wrapped with a mask, as
+    // in FxEngine, any other size with comparisons.
+    inline float* Frame(int32_t index) {
+      if (size & MASK) {
+        if (index < 0) {
+          index += size;
+        } else if (index >= static_cast<int32_t>(size)) {
+          index -= size;
+        }
+      } else {
+        index &= MASK;
+      }
+      return &buffer_[index * lanes];
+    }
+    
+    float accumulator_[lanes];
+    float previous_read_[lanes];
+    const float* lfo_value_;
+    float* buffer_;
+    int32_t write_ptr_;
+
+    DISALLOW_COPY_AND_ASSIGN(Context);
+  };
+  
+  inline void SetLFOFrequency(LFOIndex index, float frequency) {
+    lfos_.set_frequency(index, frequency);
+  }
+  
+  inline void Start(Context* c) {
+    FX_ENGINE_COUNT(samples, 1);
+    --write_ptr_;
+    if (write_ptr_ < 0) {
+      write_ptr_ += size;
+    }
+    std::fill(&c->accumulator_[0], &c->accumulator_[lanes], 0.0f);
+    std::fill(&c->previous_read_[0], &c->previous_read_[lanes], 0.0f);
+    c->buffer_ = buffer_;
+    c->write_ptr_ = write_ptr_;
+    c->lfo_value_ = lfos_.Next();
+  }
+  
+ private:
+  enum {
+    MASK = size - 1
+  };
+  
+  int32_t write_ptr_;
+  float* buffer_;
+  LFORamps<num_lfos> lfos_;
+  
+  DISALLOW_COPY_AND_ASSIGN(BatchFxEngine);
+};
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_FX_BATCH_FX_ENGINE_H_
@@ -31,20 +31,46 @@
 
 #include "stmlib/stmlib.h"
 
+#include "clouds/dsp/frame.h"
 #include "clouds/dsp/fx/fx_engine.h"
 
 namespace clouds {
 
+// The diffuser fades in over 64 samples when it resumes from bypass.
+const float kDiffuserFadeInIncrement = 1.0f / 64.0f;
+
 class Diffuser {
  public:
   Diffuser() { }
   ~Diffuser() { }
   
+  enum {
+    buffer_size = FxEngine<2048, FORMAT_32_BIT>::buffer_size
+  };
+  
   void Init(float* buffer) {
     engine_.Init(buffer);
+    amount_ = 0.0f;
+    fade_in_ = 1.0f;
+    bypassed_ = false;
   }
   
   void Process(FloatFrame* in_out, size_t size) {
+    if (amount_ == 0.0f) {
+      // Nothing to mix: skip the program. The memory is cleared once, so
+      // that stale content does not come back when the diffuser resumes, and
+      // the wet signal is faded in from there.
+      if (!bypassed_) {
+        engine_.Clear();
+        bypassed_ = true;
+      }
+      return;
+    }
+    if (bypassed_) {
+      bypassed_ = false;
+      fade_in_ = 0.0f;
+    }
+    
     typedef E::Reserve<126,
       E::Reserve<180,
       E::Reserve<269,
@@ -66,31 +92,39 @@ class Diffuser {
     while (size--) {
       engine_.Start(&c);
       
-      float wet = 0.0f;
-      c.Read(in_out->l);
-      c.Read(apl1 TAIL, kap);
-      c.WriteAllPass(apl1, -kap);
-      c.Read(apl2 TAIL, kap);
-      c.WriteAllPass(apl2, -kap);
-      c.Read(apl3 TAIL, kap);
-      c.WriteAllPass(apl3, -kap);
-      c.Read(apl4 TAIL, kap);
-      c.WriteAllPass(apl4, -kap);
-      c.Write(wet, 0.0f);
-      in_out->l += amount_ * (wet - in_out->l);
-      
-      c.Read(in_out->r);
-      c.Read(apr1 TAIL, kap);
-      c.WriteAllPass(apr1, -kap);
-      c.Read(apr2 TAIL, kap);
-      c.WriteAllPass(apr2, -kap);
-      c.Read(apr3 TAIL, kap);
-      c.WriteAllPass(apr3, -kap);
-      c.Read(apr4 TAIL, kap);
-      c.WriteAllPass(apr4, -kap);
-      c.Write(wet, 0.0f);
-      in_out->r += amount_ * (wet - in_out->r);
-
+      // The two channels are diffused independently, in two accumulators.
+      float wet_l;
+      float wet_r;
+      c.Read<ACC_1>(in_out->l);
+      c.Read<ACC_2>(in_out->r);
+      c.Read<ACC_1>(apl1 TAIL, kap);
+      c.Read<ACC_2>(apr1 TAIL, kap);
+      c.WriteAllPass<ACC_1>(apl1, -kap);
+      c.WriteAllPass<ACC_2>(apr1, -kap);
+      c.Read<ACC_1>(apl2 TAIL, kap);
+      c.Read<ACC_2>(apr2 TAIL, kap);
+      c.WriteAllPass<ACC_1>(apl2, -kap);
+      c.WriteAllPass<ACC_2>(apr2, -kap);
+      c.Read<ACC_1>(apl3 TAIL, kap);
+      c.Read<ACC_2>(apr3 TAIL, kap);
+      c.WriteAllPass<ACC_1>(apl3, -kap);
+      c.WriteAllPass<ACC_2>(apr3, -kap);
+      c.Read<ACC_1>(apl4 TAIL, kap);
+      c.Read<ACC_2>(apr4 TAIL, kap);
+      c.WriteAllPass<ACC_1>(apl4, -kap);
+      c.WriteAllPass<ACC_2>(apr4, -kap);
+      c.Write<ACC_1>(wet_l, 0.0f);
+      c.Write<ACC_2>(wet_r, 0.0f);
+      float amount = amount_;
+      if (fade_in_ != 1.0f) {
+        fade_in_ += kDiffuserFadeInIncrement;
+        if (fade_in_ >= 1.0f) {
+          fade_in_ = 1.0f;
+        }
+        amount *= fade_in_;
+      }
+      in_out->l += amount * (wet_l - in_out->l);
+      in_out->r += amount * (wet_r - in_out->r);
       ++in_out;
     }
   }
@@ -100,10 +134,13 @@ class Diffuser {
   }
   
  private:
-  typedef FxEngine<2048, FORMAT_32_BIT> E;
+  typedef FxEngine<2048, FORMAT_32_BIT, 2, 0, 0, 2> E;
   E engine_;
   
   float amount_;
+  float fade_in_;
+  bool bypassed_;
+  
   DISALLOW_COPY_AND_ASSIGN(Diffuser);
 };
 
@@ -31,11 +31,19 @@
 
 #include <algorithm>
 
+#ifdef __F16C__
+#include <immintrin.h>
+#endif  // __F16C__
+
 #include "stmlib/stmlib.h"
 
 #include "stmlib/dsp/dsp.h"
 #include "stmlib/dsp/cosine_oscillator.h"
 
+#include "clouds/dsp/fx/q15.h"
+#include "clouds/dsp/interpolation.h"
+#include "clouds/dsp/mu_law.h"
+
 namespace clouds {
 
 #define TAIL , -1
@@ -43,12 +51,134 @@ namespace clouds {
 enum Format {
   FORMAT_12_BIT,
   FORMAT_16_BIT,
-  FORMAT_32_BIT
+  FORMAT_32_BIT,
+  FORMAT_FLOAT16,
+  FORMAT_8_BIT_MULAW
 };
 
 enum LFOIndex {
   LFO_1,
-  LFO_2
+  LFO_2,
+  LFO_3,
+  LFO_4,
+  LFO_5,
+  LFO_6,
+  LFO_7,
+  LFO_8
+};
+
+// Memory region in which a delay line is allocated. External memory is the
+// buffer passed to Init(), which can be large but slow (SDRAM); internal memory
+// is a small array inside the engine object itself, for short and frequently
+// accessed lines.
+enum MemoryRegion {
+  MEMORY_EXTERNAL,
+  MEMORY_INTERNAL
+};
+
+enum AccumulatorIndex {
+  ACC_1,
+  ACC_2,
+  ACC_3,
+  ACC_4
+};
+
+// Largest number of accumulators of a Context.
+const size_t kNumAccumulators = 4;
+
+#ifdef FX_ENGINE_COST_MODEL
+
+// Host-side instrumentation: counts the memory accesses and conversions
+// performed by all engines, to compare topologies without running them on
+// the hardware.
+struct FxEngineCost {
+  uint32_t samples;
+  uint32_t reads;
+  uint32_t writes;
+  uint32_t bytes;
+  uint32_t interpolations;
+  uint32_t lfo_evaluations;
+  uint32_t compressions;
+  uint32_t decompressions;
+  
+  void Reset() {
+    samples = reads = writes = bytes = interpolations = lfo_evaluations = 0;
+    compressions = decompressions = 0;
+  }
+};
+
+// Number of samples read by each interpolation kernel.
+const uint32_t kInterpolationTaps[] = { 1, 2, 4, 2 };
+
+inline FxEngineCost& fx_engine_cost() {
+  static FxEngineCost cost;
+  return cost;
+}
+
+#define FX_ENGINE_COUNT(counter, n) fx_engine_cost().counter += (n)
+
+#else
+
+#define FX_ENGINE_COUNT(counter, n)
+
+#endif  // FX_ENGINE_COST_MODEL
+
+// The LFOs are advanced once every kLFOBlockSize samples, and linearly
+// interpolated in between.
+const size_t kLFOBlockSize = 32;
+
+// The LFOs of an engine. Each time they are stepped, the ramps to their new
+// values are rendered for the next kLFOBlockSize samples. The ramps are
+// stored interleaved, so that a Context only needs one pointer to access the
+// current value of all LFOs.
+template<size_t num_lfos>
+class LFORamps {
+ public:
+  LFORamps() { }
+  ~LFORamps() { }
+  
+  void Init() {
+    for (size_t i = 0; i < num_lfos; ++i) {
+      set_frequency(static_cast<LFOIndex>(i), 0.0f);
+    }
+    position_ = kLFOBlockSize;
+  }
+  
+  inline void set_frequency(LFOIndex index, float frequency) {
+    lfo_[index].template Init<stmlib::COSINE_OSCILLATOR_APPROXIMATE>(
+        frequency * static_cast<float>(kLFOBlockSize));
+  }
+  
+  // Values of all LFOs for the next sample.
+  inline const float* Next() {
+    if (position_ == kLFOBlockSize) {
+      Render();
+    }
+    return &ramp_[position_++][0];
+  }
+  
+ private:
+  void Render() {
+    float start[num_lfos];
+    float increment[num_lfos];
+    for (size_t i = 0; i < num_lfos; ++i) {
+      start[i] = lfo_[i].value();
+      increment[i] = (lfo_[i].Next() - start[i]) * (1.0f / kLFOBlockSize);
+    }
+    for (size_t j = 0; j < kLFOBlockSize; ++j) {
+      const float t = static_cast<float>(j + 1);
+      for (size_t i = 0; i < num_lfos; ++i) {
+        ramp_[j][i] = start[i] + increment[i] * t;
+      }
+    }
+    position_ = 0;
+  }
+  
+  stmlib::CosineOscillator lfo_[num_lfos];
+  float ramp_[kLFOBlockSize][num_lfos];
+  size_t position_;
+  
+  DISALLOW_COPY_AND_ASSIGN(LFORamps);
 };
 
 template<Format format>
@@ -66,6 +196,18 @@ struct DataType<FORMAT_12_BIT> {
     return static_cast<uint16_t>(
         stmlib::Clip16(static_cast<int32_t>(value * 4096.0f)));
   }
+  
+  static inline void Decompress(const T* in, float* out, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = Decompress(in[i]);
+    }
+  }
+  
+  static inline void Compress(const float* in, T* out, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = Compress(in[i]);
+    }
+  }
 };
 
 template<>
@@ -80,6 +222,18 @@ struct DataType<FORMAT_16_BIT> {
     return static_cast<uint16_t>(
         stmlib::Clip16(static_cast<int32_t>(value * 32768.0f)));
   }
+  
+  static inline void Decompress(const T* in, float* out, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = Decompress(in[i]);
+    }
+  }
+  
+  static inline void Compress(const float* in, T* out, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = Compress(in[i]);
+    }
+  }
 };
 
 template<>
@@ -93,34 +247,205 @@ struct DataType<FORMAT_32_BIT> {
   static inline T Compress(float value) {
     return value;
   }
+  
+  static inline void Decompress(const T* in, float* out, size_t size) {
+    std::copy(&in[0], &in[size], &out[0]);
+  }
+  
+  static inline void Compress(const float* in, T* out, size_t size) {
+    std::copy(&in[0], &in[size], &out[0]);
+  }
 };
 
+// IEEE 754 binary16. Values beyond the largest finite half are clipped to it,
+// so that a runaway feedback loop saturates instead of storing infinities.
+// Uses the F16C instructions on x86 or the VCVTB instructions on Cortex-M
+// (build with -mfp16-format=ieee) when available; the portable fallback
+// flushes denormals to zero.
+template<>
+struct DataType<FORMAT_FLOAT16> {
+  typedef uint16_t T;
+  
+  static inline float Decompress(T value) {
+#if defined(__ARM_FP16_FORMAT_IEEE)
+    __fp16 h;
+    *reinterpret_cast<uint16_t*>(&h) = value;
+    return static_cast<float>(h);
+#elif defined(__F16C__)
+    return _cvtsh_ss(value);
+#else
+    // Shifting the exponent/mantissa in place and multiplying by 2^112
+    // rebiases the exponent (15 -> 127) and handles zero in a single step.
+    union { uint32_t u; float f; } x;
+    x.u = static_cast<uint32_t>(value & 0x7fff) << 13;
+    x.f *= 5.192296858534828e33f;
+    x.u |= static_cast<uint32_t>(value & 0x8000) << 16;
+    return x.f;
+#endif
+  }
+  
+  static inline T Compress(float value) {
+    CONSTRAIN(value, -65504.0f, 65504.0f);
+#if defined(__ARM_FP16_FORMAT_IEEE)
+    __fp16 h = static_cast<__fp16>(value);
+    return *reinterpret_cast<uint16_t*>(&h);
+#elif defined(__F16C__)
+    return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+    union { uint32_t u; float f; } x;
+    x.f = value;
+    uint32_t sign = (x.u >> 16) & 0x8000;
+    uint32_t magnitude = x.u & 0x7fffffff;
+    // Round to nearest, then rebias the exponent (127 -> 15).
+    uint32_t h = (magnitude + 0x00001000 - 0x38000000) >> 13;
+    h = magnitude < 0x38800000 ? 0 : h;
+    return static_cast<T>(sign | h);
+#endif
+  }
+  
+  static inline void Decompress(const T* in, float* out, size_t size) {
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+    for (; i + 8 <= size; i += 8) {
+      _mm256_storeu_ps(&out[i], _mm256_cvtph_ps(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[i]))));
+    }
+#endif
+    for (; i < size; ++i) {
+      out[i] = Decompress(in[i]);
+    }
+  }
+  
+  static inline void Compress(const float* in, T* out, size_t size) {
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+    const __m256 max = _mm256_set1_ps(65504.0f);
+    const __m256 min = _mm256_set1_ps(-65504.0f);
+    for (; i + 8 <= size; i += 8) {
+      __m256 x = _mm256_loadu_ps(&in[i]);
+      x = _mm256_max_ps(_mm256_min_ps(x, max), min);
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(&out[i]),
+          _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < size; ++i) {
+      out[i] = Compress(in[i]);
+    }
+  }
+};
+
+// 8-bit mu-law, as used by the low-fidelity recording buffers. Halves the
+// memory of FORMAT_16_BIT for long, sparsely read delay lines.
+template<>
+struct DataType<FORMAT_8_BIT_MULAW> {
+  typedef uint8_t T;
+  
+  static inline float Decompress(T value) {
+    return static_cast<float>(MuLaw2Lin(value)) / 32768.0f;
+  }
+  
+  static inline T Compress(float value) {
+    return Lin2MuLaw(
+        stmlib::Clip16(static_cast<int32_t>(value * 32768.0f)));
+  }
+  
+  static inline void Decompress(const T* in, float* out, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = Decompress(in[i]);
+    }
+  }
+  
+  static inline void Compress(const float* in, T* out, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = Compress(in[i]);
+    }
+  }
+};
+
+template<typename Engine> class ProgramInterpreter;
+
 template<
     size_t size,
-    Format format = FORMAT_12_BIT>
+    Format format = FORMAT_12_BIT,
+    size_t num_lfos = 2,
+    size_t internal_size = 0,
+    size_t rebase_period = 0,
+    size_t num_accumulators = 1>
 class FxEngine {
  public:
-  typedef typename DataType<format>::T T;
+  typedef DataType<format> Storage;
+  typedef typename Storage::T T;
+  
+  // When rebase_period is 0, the delay memory is a circular buffer of size
+  // samples, and all accesses are masked. Otherwise, it is a linear buffer of
+  // size + rebase_period samples, through which the write pointer moves
+  // down; every rebase_period samples the live part of the buffer is moved
+  // back to its top. Accesses are not masked, at the cost of one copy of the
+  // delay memory every rebase_period samples.
+  enum {
+    buffer_size = size + rebase_period
+  };
+  
+  // Limits against which the ProgramInterpreter checks its instructions.
+  enum {
+    external_memory_size = size,
+    internal_memory_size = internal_size,
+    lfo_count = num_lfos
+  };
+  
   FxEngine() { }
   ~FxEngine() { }
 
   void Init(T* buffer) {
     buffer_ = buffer;
+    lfos_.Init();
     Clear();
   }
   
   void Clear() {
-    std::fill(&buffer_[0], &buffer_[size], 0);
+    // Zero is not encoded as 0 in all formats (mu-law).
+    std::fill(
+        &buffer_[0],
+        &buffer_[buffer_size],
+        DataType<format>::Compress(0.0f));
+    std::fill(
+        &internal_buffer_[0],
+        &internal_buffer_[internal_size],
+        DataType<format>::Compress(0.0f));
     write_ptr_ = 0;
   }
 
   struct Empty { };
   
-  template<int32_t l, typename T = Empty>
+  template<
+      int32_t l,
+      typename T = Empty,
+      MemoryRegion r = MEMORY_EXTERNAL>
   struct Reserve {
     typedef T Tail;
     enum {
-      length = l
+      length = l,
+      region = r
+    };
+  };
+  
+  template<int32_t l, typename T = Empty>
+  struct InternalReserve : public Reserve<l, T, MEMORY_INTERNAL> { };
+  
+  // Memory used by the first n lines of Memory allocated in a given region.
+  template<typename Memory, int32_t n, int32_t region>
+  struct RegionSize {
+    enum {
+      value = RegionSize<typename Memory::Tail, n - 1, region>::value + \
+          (Memory::region == region ? Memory::length + 1 : 0)
+    };
+  };
+
+  template<typename Memory, int32_t region>
+  struct RegionSize<Memory, 0, region> {
+    enum {
+      value = 0
     };
   };
   
@@ -128,7 +453,8 @@ class FxEngine {
   struct DelayLine {
     enum {
       length = DelayLine<typename Memory::Tail, index - 1>::length,
-      base = DelayLine<Memory, index - 1>::base + DelayLine<Memory, index - 1>::length + 1
+      region = DelayLine<typename Memory::Tail, index - 1>::region,
+      base = RegionSize<Memory, index, region>::value
     };
   };
 
@@ -136,163 +462,521 @@ class FxEngine {
   struct DelayLine<Memory, 0> {
     enum {
       length = Memory::length,
+      region = Memory::region,
       base = 0
     };
   };
 
+  template<typename D>
+  struct Capacity {
+    enum {
+      value = D::region == static_cast<int32_t>(MEMORY_INTERNAL)
+          ? internal_size
+          : size
+    };
+  };
+
+  // A Context has num_accumulators accumulators, each of them with its own
+  // previous read. All the methods below work on ACC_1, unless they are given
+  // an accumulator index, below num_accumulators, as template argument: this
+  // allows independent chains (for example the two halves of a reverb loop)
+  // to be interleaved, so that their operations can be issued in parallel.
+  // Only the accumulators in use are cleared at each sample.
   class Context {
    friend class FxEngine;
    public:
     Context() { }
     ~Context() { }
     
+    template<AccumulatorIndex a>
     inline void Load(float value) {
-      accumulator_ = value;
+      accumulator<a>() = value;
     }
 
+    template<AccumulatorIndex a>
     inline void Read(float value, float scale) {
-      accumulator_ += value * scale;
+      accumulator<a>() += value * scale;
     }
 
+    template<AccumulatorIndex a>
     inline void Read(float value) {
-      accumulator_ += value;
+      accumulator<a>() += value;
     }
 
+    template<AccumulatorIndex a>
     inline void Write(float& value) {
-      value = accumulator_;
+      value = accumulator<a>();
     }
 
+    template<AccumulatorIndex a>
     inline void Write(float& value, float scale) {
-      value = accumulator_;
-      accumulator_ *= scale;
+      value = accumulator<a>();
+      accumulator<a>() *= scale;
     }
     
-    template<typename D>
+    template<AccumulatorIndex a, typename D>
     inline void Write(D& d, int32_t offset, float scale) {
-      STATIC_ASSERT(D::base + D::length <= size, delay_memory_full);
-      T w = DataType<format>::Compress(accumulator_);
+      STATIC_ASSERT(
+          D::base + D::length <= Capacity<D>::value, delay_memory_full);
+      FX_ENGINE_COUNT(writes, 1);
+      FX_ENGINE_COUNT(bytes, sizeof(T));
+      FX_ENGINE_COUNT(compressions, 1);
+      Store(
+          accumulator_index<a>(),
+          Cell<D>(Position(D::base, D::length, offset)),
+          scale);
+    }
+    
+    template<AccumulatorIndex a, typename D>
+    inline void Write(D& d, float scale) {
+      Write<a>(d, 0, scale);
+    }
+
+    template<AccumulatorIndex a, typename D>
+    inline void WriteAllPass(D& d, int32_t offset, float scale) {
+      Write<a>(d, offset, scale);
+      accumulator<a>() += previous_read_[a];
+    }
+    
+    template<AccumulatorIndex a, typename D>
+    inline void WriteAllPass(D& d, float scale) {
+      WriteAllPass<a>(d, 0, scale);
+    }
+    
+    template<AccumulatorIndex a, typename D>
+    inline void Read(D& d, int32_t offset, float scale) {
+      STATIC_ASSERT(
+          D::base + D::length <= Capacity<D>::value, delay_memory_full);
+      FX_ENGINE_COUNT(reads, 1);
+      FX_ENGINE_COUNT(bytes, sizeof(T));
+      FX_ENGINE_COUNT(decompressions, 1);
+      T r;
       if (offset == -1) {
-        buffer_[(write_ptr_ + D::base + D::length - 1) & MASK] = w;
+        r = Cell<D>(write_ptr_ + D::base + D::length - 1);
       } else {
-        buffer_[(write_ptr_ + D::base + offset) & MASK] = w;
+        r = Cell<D>(write_ptr_ + D::base + offset);
       }
-      accumulator_ *= scale;
+      Accumulate(
+          accumulator_index<a>(), DataType<format>::Decompress(r), scale);
+    }
+    
+    template<AccumulatorIndex a, typename D>
+    inline void Read(D& d, float scale) {
+      Read<a>(d, 0, scale);
+    }
+    
+    template<AccumulatorIndex a>
+    inline void Lp(float& state, float coefficient) {
+      state += coefficient * (accumulator<a>() - state);
+      accumulator<a>() = state;
+    }
+
+    template<AccumulatorIndex a>
+    inline void Hp(float& state, float coefficient) {
+      state += coefficient * (accumulator<a>() - state);
+      accumulator<a>() -= state;
+    }
+    
+    template<
+        AccumulatorIndex a,
+        InterpolationMethod method = INTERPOLATION_LINEAR,
+        typename D>
+    inline void Interpolate(D& d, float offset, float scale) {
+      STATIC_ASSERT(method != INTERPOLATION_ALLPASS, allpass_requires_state);
+      Accumulate(accumulator_index<a>(), Tap<method>(d, offset, NULL), scale);
+    }
+    
+    template<
+        AccumulatorIndex a,
+        InterpolationMethod method = INTERPOLATION_LINEAR,
+        typename D>
+    inline void Interpolate(
+        D& d, float offset, LFOIndex index, float amplitude, float scale) {
+      STATIC_ASSERT(method != INTERPOLATION_ALLPASS, allpass_requires_state);
+      FX_ENGINE_COUNT(lfo_evaluations, 1);
+      offset += amplitude * lfo_value_[index];
+      Accumulate(accumulator_index<a>(), Tap<method>(d, offset, NULL), scale);
+    }
+    
+    // Same as above, for the stateful kernels.
+    template<AccumulatorIndex a, InterpolationMethod method, typename D>
+    inline void Interpolate(D& d, float offset, float scale, float& state) {
+      Accumulate(
+          accumulator_index<a>(), Tap<method>(d, offset, &state), scale);
+    }
+    
+    template<AccumulatorIndex a, InterpolationMethod method, typename D>
+    inline void Interpolate(
+        D& d,
+        float offset,
+        LFOIndex index,
+        float amplitude,
+        float scale,
+        float& state) {
+      FX_ENGINE_COUNT(lfo_evaluations, 1);
+      offset += amplitude * lfo_value_[index];
+      Accumulate(
+          accumulator_index<a>(), Tap<method>(d, offset, &state), scale);
+    }
+    
+    // Single accumulator versions.
+    inline void Load(float value) {
+      Load<ACC_1>(value);
+    }
+
+    inline void Read(float value, float scale) {
+      Read<ACC_1>(value, scale);
+    }
+
+    inline void Read(float value) {
+      Read<ACC_1>(value);
+    }
+
+    inline void Write(float& value) {
+      Write<ACC_1>(value);
+    }
+
+    inline void Write(float& value, float scale) {
+      Write<ACC_1>(value, scale);
+    }
+    
+    template<typename D>
+    inline void Write(D& d, int32_t offset, float scale) {
+      Write<ACC_1>(d, offset, scale);
     }
     
     template<typename D>
     inline void Write(D& d, float scale) {
-      Write(d, 0, scale);
+      Write<ACC_1>(d, 0, scale);
     }
 
     template<typename D>
     inline void WriteAllPass(D& d, int32_t offset, float scale) {
-      Write(d, offset, scale);
-      accumulator_ += previous_read_;
+      WriteAllPass<ACC_1>(d, offset, scale);
     }
     
     template<typename D>
     inline void WriteAllPass(D& d, float scale) {
-      WriteAllPass(d, 0, scale);
+      WriteAllPass<ACC_1>(d, 0, scale);
     }
     
     template<typename D>
     inline void Read(D& d, int32_t offset, float scale) {
-      STATIC_ASSERT(D::base + D::length <= size, delay_memory_full);
-      T r;
-      if (offset == -1) {
-        r = buffer_[(write_ptr_ + D::base + D::length - 1) & MASK];
-      } else {
-        r = buffer_[(write_ptr_ + D::base + offset) & MASK];
-      }
-      float r_f = DataType<format>::Decompress(r);
-      previous_read_ = r_f;
-      accumulator_ += r_f * scale;
+      Read<ACC_1>(d, offset, scale);
     }
     
     template<typename D>
     inline void Read(D& d, float scale) {
-      Read(d, 0, scale);
+      Read<ACC_1>(d, 0, scale);
     }
     
     inline void Lp(float& state, float coefficient) {
-      state += coefficient * (accumulator_ - state);
-      accumulator_ = state;
+      Lp<ACC_1>(state, coefficient);
     }
 
     inline void Hp(float& state, float coefficient) {
-      state += coefficient * (accumulator_ - state);
-      accumulator_ -= state;
+      Hp<ACC_1>(state, coefficient);
     }
     
-    template<typename D>
+    template<InterpolationMethod method = INTERPOLATION_LINEAR, typename D>
     inline void Interpolate(D& d, float offset, float scale) {
-      STATIC_ASSERT(D::base + D::length <= size, delay_memory_full);
-      MAKE_INTEGRAL_FRACTIONAL(offset);
-      float a = DataType<format>::Decompress(
-          buffer_[(write_ptr_ + offset_integral + D::base) & MASK]);
-      float b = DataType<format>::Decompress(
-          buffer_[(write_ptr_ + offset_integral + D::base + 1) & MASK]);
-      float x = a + (b - a) * offset_fractional;
-      previous_read_ = x;
-      accumulator_ += x * scale;
+      Interpolate<ACC_1, method>(d, offset, scale);
     }
     
-    template<typename D>
+    template<InterpolationMethod method = INTERPOLATION_LINEAR, typename D>
     inline void Interpolate(
         D& d, float offset, LFOIndex index, float amplitude, float scale) {
-      STATIC_ASSERT(D::base + D::length <= size, delay_memory_full);
-      offset += amplitude * lfo_value_[index];
-      MAKE_INTEGRAL_FRACTIONAL(offset);
-      float a = DataType<format>::Decompress(
-          buffer_[(write_ptr_ + offset_integral + D::base) & MASK]);
-      float b = DataType<format>::Decompress(
-          buffer_[(write_ptr_ + offset_integral + D::base + 1) & MASK]);
-      float x = a + (b - a) * offset_fractional;
-      previous_read_ = x;
-      accumulator_ += x * scale;
+      Interpolate<ACC_1, method>(d, offset, index, amplitude, scale);
+    }
+    
+    template<InterpolationMethod method, typename D>
+    inline void Interpolate(D& d, float offset, float scale, float& state) {
+      Interpolate<ACC_1, method>(d, offset, scale, state);
+    }
+    
+    template<InterpolationMethod method, typename D>
+    inline void Interpolate(
+        D& d,
+        float offset,
+        LFOIndex index,
+        float amplitude,
+        float scale,
+        float& state) {
+      Interpolate<ACC_1, method>(d, offset, index, amplitude, scale, state);
     }
     
    private:
-    float accumulator_;
-    float previous_read_;
-    float lfo_value_[2];
+    template<typename Engine> friend class ProgramInterpreter;
+    
+    // Accumulator indices are template arguments, so that using an
+    // accumulator the engine does not have is a compile-time error.
+    template<AccumulatorIndex a>
+    inline AccumulatorIndex accumulator_index() {
+      STATIC_ASSERT(a < num_accumulators, not_enough_accumulators);
+      return a;
+    }
+    
+    template<AccumulatorIndex a>
+    inline float& accumulator() {
+      return accumulator_[accumulator_index<a>()];
+    }
+    
+    // The kernels below take the region, position and interpolation method
+    // of an access as arguments, so that the ProgramInterpreter can run them
+    // with values only known at run time. The methods above pass compile-time
+    // constants, so only the selected branches are compiled in.
+    inline int32_t Position(int32_t base, int32_t length, int32_t offset) {
+      return write_ptr_ + base + (offset == -1 ? length - 1 : offset);
+    }
+    
+    inline T& Cell(int32_t region, int32_t index) {
+      return region == static_cast<int32_t>(MEMORY_INTERNAL)
+          ? internal_buffer_[index & INTERNAL_MASK]
+          : buffer_[index & MASK];
+    }
+    
+    template<typename D>
+    inline T& Cell(int32_t index) {
+      return Cell(D::region, index);
+    }
+    
+    inline void Accumulate(AccumulatorIndex a, float x, float scale) {
+      previous_read_[a] = x;
+      accumulator_[a] += x * scale;
+    }
+    
+    inline void Store(AccumulatorIndex a, T& cell, float scale) {
+      cell = DataType<format>::Compress(accumulator_[a]);
+      accumulator_[a] *= scale;
+    }
+    
+    // HERMITE reads one sample past each side of the tap, so the offset
+    // should be at least 1. ALLPASS needs a state; ZOH is not supported.
+    inline float Tap(
+        InterpolationMethod method,
+        int32_t region,
+        int32_t base,
+        float offset,
+        float* state) {
+      MAKE_INTEGRAL_FRACTIONAL(offset);
+      const int32_t index = write_ptr_ + offset_integral + base;
+      const float x0 = DataType<format>::Decompress(Cell(region, index));
+      const float x1 = DataType<format>::Decompress(Cell(region, index + 1));
+      const float t = offset_fractional;
+      if (method == INTERPOLATION_HERMITE) {
+        const float xm1 = DataType<format>::Decompress(
+            Cell(region, index - 1));
+        const float x2 = DataType<format>::Decompress(
+            Cell(region, index + 2));
+        const float c = (x1 - xm1) * 0.5f;
+        const float v = x0 - x1;
+        const float w = c + v;
+        const float a = w + v + (x2 - x0) * 0.5f;
+        const float b_neg = w + a;
+        return (((a * t) - b_neg) * t + c) * t + x0;
+      } else if (method == INTERPOLATION_ALLPASS) {
+        const float eta = (1.0f - t) / (1.0f + t);
+        *state = x1 + eta * (x0 - *state);
+        return *state;
+      } else {
+        return x0 + (x1 - x0) * t;
+      }
+    }
+    
+    template<InterpolationMethod method, typename D>
+    inline float Tap(D& d, float offset, float* state) {
+      STATIC_ASSERT(method != INTERPOLATION_ZOH, zoh_not_supported);
+      STATIC_ASSERT(
+          D::base + D::length <= Capacity<D>::value, delay_memory_full);
+      FX_ENGINE_COUNT(interpolations, 1);
+      FX_ENGINE_COUNT(reads, kInterpolationTaps[method]);
+      FX_ENGINE_COUNT(bytes, kInterpolationTaps[method] * sizeof(T));
+      FX_ENGINE_COUNT(decompressions, kInterpolationTaps[method]);
+      return Tap(method, D::region, D::base, offset, state);
+    }
+    
+    float accumulator_[num_accumulators];
+    float previous_read_[num_accumulators];
+    const float* lfo_value_;
     T* buffer_;
+    T* internal_buffer_;
     int32_t write_ptr_;
 
     DISALLOW_COPY_AND_ASSIGN(Context);
   };
   
+  // Fixed point counterpart of Context, for FORMAT_16_BIT engines. Samples
+  // and scales are Q15, and the accumulator is Q30, so gains must stay in
+  // [-1, 1). Linear interpolations load their two taps with a single access
+  // and compute them with one dual multiply-accumulate. They do not update
+  // the previous read.
+  class FixedContext {
+   friend class FxEngine;
+   public:
+    FixedContext() { }
+    ~FixedContext() { }
+    
+    inline void Load(int16_t value) {
+      accumulator_ = static_cast<int32_t>(value) << 15;
+    }
+    
+    inline void Read(int16_t value, int16_t scale) {
+      accumulator_ += value * scale;
+    }
+    
+    inline void Write(int16_t& value, int16_t scale) {
+      value = Saturate();
+      accumulator_ = value * scale;
+    }
+    
+    template<typename D>
+    inline void Write(D& d, int32_t offset, int16_t scale) {
+      STATIC_ASSERT(
+          D::base + D::length <= Capacity<D>::value, delay_memory_full);
+      int16_t w = Saturate();
+      Cell<D>(write_ptr_ + D::base + (offset == -1
+          ? D::length - 1
+          : offset)) = static_cast<T>(w);
+      accumulator_ = w * scale;
+    }
+    
+    template<typename D>
+    inline void WriteAllPass(D& d, int32_t offset, int16_t scale) {
+      Write(d, offset, scale);
+      accumulator_ += static_cast<int32_t>(previous_read_) << 15;
+    }
+    
+    template<typename D>
+    inline void Read(D& d, int32_t offset, int16_t scale) {
+      STATIC_ASSERT(
+          D::base + D::length <= Capacity<D>::value, delay_memory_full);
+      int16_t r = static_cast<int16_t>(Cell<D>(
+          write_ptr_ + D::base + (offset == -1 ? D::length - 1 : offset)));
+      previous_read_ = r;
+      accumulator_ += r * scale;
+    }
+    
+    inline void Lp(int32_t& state, int16_t coefficient) {
+      state += ((accumulator_ - state) >> 15) * coefficient;
+      accumulator_ = state;
+    }
+    
+    template<typename D>
+    inline void Interpolate(D& d, float offset, int16_t scale) {
+      STATIC_ASSERT(
+          D::base + D::length <= Capacity<D>::value, delay_memory_full);
+      MAKE_INTEGRAL_FRACTIONAL(offset);
+      const int32_t index = write_ptr_ + offset_integral + D::base;
+      const T* x0 = &Cell<D>(index);
+      const T* x1 = &Cell<D>(index + 1);
+      // The two taps are contiguous, unless the read wraps around.
+      uint32_t taps = x1 == x0 + 1
+          ? Load16x2(x0)
+          : Pack16(static_cast<int16_t>(*x0), static_cast<int16_t>(*x1));
+      int16_t t = static_cast<int16_t>(offset_fractional * scale);
+      accumulator_ = Smlad(taps, Pack16(scale - t, t), accumulator_);
+    }
+    
+   private:
+    STATIC_ASSERT(format == FORMAT_16_BIT, fixed_point_requires_16_bit);
+    
+    inline int16_t Saturate() const {
+      return static_cast<int16_t>(Ssat16(accumulator_ >> 15));
+    }
+    
+    template<typename D>
+    inline T& Cell(int32_t index) {
+      return D::region == static_cast<int32_t>(MEMORY_INTERNAL)
+          ? internal_buffer_[index & INTERNAL_MASK]
+          : buffer_[index & MASK];
+    }
+    
+    int32_t accumulator_;
+    int16_t previous_read_;
+    T* buffer_;
+    T* internal_buffer_;
+    int32_t write_ptr_;
+
+    DISALLOW_COPY_AND_ASSIGN(FixedContext);
+  };
+  
   inline void SetLFOFrequency(LFOIndex index, float frequency) {
-    lfo_[index].template Init<stmlib::COSINE_OSCILLATOR_APPROXIMATE>(
-        frequency * 32.0f);
+    lfos_.set_frequency(index, frequency);
   }
   
   inline void Start(Context* c) {
-    --write_ptr_;
-    if (write_ptr_ < 0) {
-      write_ptr_ += size;
-    }
-    c->accumulator_ = 0.0f;
-    c->previous_read_ = 0.0f;
+    FX_ENGINE_COUNT(samples, 1);
+    Advance();
+    std::fill(&c->accumulator_[0], &c->accumulator_[num_accumulators], 0.0f);
+    std::fill(
+        &c->previous_read_[0], &c->previous_read_[num_accumulators], 0.0f);
     c->buffer_ = buffer_;
+    c->internal_buffer_ = internal_buffer_;
+    c->write_ptr_ = write_ptr_;
+    c->lfo_value_ = lfos_.Next();
+  }
+  
+  inline void Start(FixedContext* c) {
+    FX_ENGINE_COUNT(samples, 1);
+    Advance();
+    c->accumulator_ = 0;
+    c->previous_read_ = 0;
+    c->buffer_ = buffer_;
+    c->internal_buffer_ = internal_buffer_;
     c->write_ptr_ = write_ptr_;
-    if ((write_ptr_ & 31) == 0) {
-      c->lfo_value_[0] = lfo_[0].Next();
-      c->lfo_value_[1] = lfo_[1].Next();
-    } else {
-      c->lfo_value_[0] = lfo_[0].value();
-      c->lfo_value_[1] = lfo_[1].value();
-    }
   }
   
  private:
+  template<typename Engine> friend class ProgramInterpreter;
+  
   enum {
-    MASK = size - 1
+    MASK = rebase_period ? -1 : size - 1,
+    INTERNAL_MASK = internal_size - 1
   };
   
+  STATIC_ASSERT(internal_size <= size, internal_memory_too_large);
+  STATIC_ASSERT(
+      num_accumulators >= 1 && num_accumulators <= kNumAccumulators,
+      invalid_number_of_accumulators);
+  
+  // The internal memory is still circular, and must not see the jump of the
+  // write pointer.
+  STATIC_ASSERT(
+      internal_size == 0 || rebase_period % internal_size == 0,
+      rebase_period_not_a_multiple_of_internal_size);
+  
+  template<typename D>
+  inline T& Cell(int32_t index) {
+    return D::region == static_cast<int32_t>(MEMORY_INTERNAL)
+        ? internal_buffer_[index & INTERNAL_MASK]
+        : buffer_[index & MASK];
+  }
+  
+  inline void Advance() {
+    --write_ptr_;
+    if (write_ptr_ < 0) {
+      if (rebase_period) {
+        Rebase();
+      } else {
+        write_ptr_ += size;
+      }
+    }
+  }
+  
+  // The write pointer has just moved below the buffer: the live samples are
+  // those at [0, size - 1), which are moved up by rebase_period samples.
+  void Rebase() {
+    std::copy_backward(
+        &buffer_[0],
+        &buffer_[size - 1],
+        &buffer_[size - 1 + rebase_period]);
+    write_ptr_ += rebase_period;
+  }
+  
   int32_t write_ptr_;
   T* buffer_;
-  stmlib::CosineOscillator lfo_[2];
+  T internal_buffer_[internal_size ? internal_size : 1];
+  LFORamps<num_lfos> lfos_;
   
   DISALLOW_COPY_AND_ASSIGN(FxEngine);
 };
@@ -0,0 +1,586 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Declarative description of FxEngine networks.
+//
+// A network is a list of instructions, in the spirit of FV-1 assembly:
+//
+//   typedef E::DelayLine<Memory, 0> ap1;
+//   typedef Program<
+//       op::ReadMono<op::K<0> >,
+//       op::Read<ap1, kTail, op::K<1> >,
+//       op::WriteAllPass<ap1, 0, op::NegK<1> >,
+//       op::Crossfade<0, op::K<2> > > Network;
+//
+// Network::Run() expands at compile time to the same straight-line sequence of
+// Context calls as a hand-written Process() loop. The same program can also
+// be assembled into a table of ProgramInstructions and executed by a
+// ProgramInterpreter, which accepts instruction tables built at run time, to
+// try new topologies on the host without recompiling anything. Both evaluate
+// the same operations in the same order; their outputs are identical unless
+// the compiler fuses multiply-adds (-ffp-contract), which it does differently
+// for the constant scales of the compiled version.
+
+#ifndef CLOUDS_DSP_FX_FX_PROGRAM_H_
+#define CLOUDS_DSP_FX_FX_PROGRAM_H_
+
+#include "stmlib/stmlib.h"
+
+#include <algorithm>
+
+#include "clouds/dsp/frame.h"
+#include "clouds/dsp/fx/fx_engine.h"
+
+namespace clouds {
+
+const int32_t kTail = -1;
+const size_t kProgramNumRegisters = 8;
+const size_t kProgramNumFilters = 8;
+const size_t kProgramNumCoefficients = 8;
+const size_t kProgramMaxSize = 64;
+
+// Everything a program reads or writes, apart from the delay memory.
+struct ProgramState {
+  // Frame being processed: read by ReadInput, modified by Crossfade.
+  float io[2];
+  // Temporary values.
+  float registers[kProgramNumRegisters];
+  // States of the LP/HP filters. Persistent across samples.
+  float filters[kProgramNumFilters];
+  // Coefficients, set by the owner of the program.
+  float k[kProgramNumCoefficients];
+};
+
+enum ProgramOpcode {
+  OPCODE_LOAD,
+  OPCODE_STORE,
+  OPCODE_READ_REGISTER,
+  OPCODE_READ_INPUT,
+  OPCODE_READ_MONO,
+  OPCODE_READ,
+  OPCODE_WRITE,
+  OPCODE_WRITE_ALL_PASS,
+  OPCODE_INTERPOLATE,
+  OPCODE_LP,
+  OPCODE_HP,
+  OPCODE_CROSSFADE
+};
+
+struct ProgramInstruction {
+  ProgramOpcode opcode;
+  
+  // Register, channel or filter index.
+  int32_t operand;
+  
+  // Delay line access.
+  int32_t region;
+  int32_t base;
+  int32_t length;
+  int32_t offset;
+  int32_t lfo;
+  float amplitude;
+  InterpolationMethod method;
+  
+  // The scale of the instruction is multiplier * k[coefficient], or just
+  // multiplier when coefficient is -1.
+  int32_t coefficient;
+  float multiplier;
+};
+
+namespace op {
+
+// Scale operands.
+
+template<int32_t index>
+struct K {
+  static inline float value(const float* k) { return k[index]; }
+  enum { coefficient = index };
+  static inline float multiplier() { return 1.0f; }
+};
+
+template<int32_t index>
+struct NegK {
+  static inline float value(const float* k) { return -k[index]; }
+  enum { coefficient = index };
+  static inline float multiplier() { return -1.0f; }
+};
+
+template<int32_t numerator, int32_t denominator = 1>
+struct Gain {
+  static inline float value(const float* k) { return multiplier(); }
+  enum { coefficient = -1 };
+  static inline float multiplier() {
+    return static_cast<float>(numerator) / static_cast<float>(denominator);
+  }
+};
+
+typedef Gain<0> Zero;
+typedef Gain<1> One;
+
+template<typename S>
+inline ProgramInstruction Describe(ProgramOpcode opcode, int32_t operand) {
+  ProgramInstruction i;
+  i.opcode = opcode;
+  i.operand = operand;
+  i.region = MEMORY_EXTERNAL;
+  i.base = i.length = i.offset = 0;
+  i.lfo = -1;
+  i.amplitude = 0.0f;
+  i.method = INTERPOLATION_LINEAR;
+  i.coefficient = S::coefficient;
+  i.multiplier = S::multiplier();
+  return i;
+}
+
+template<typename S, typename D>
+inline ProgramInstruction Describe(ProgramOpcode opcode, int32_t offset) {
+  ProgramInstruction i = Describe<S>(opcode, 0);
+  i.region = D::region;
+  i.base = D::base;
+  i.length = D::length;
+  i.offset = offset;
+  return i;
+}
+
+// Instructions.
+
+// acc = registers[r]
+template<int32_t r>
+struct Load {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    c->Load(s->registers[r]);
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<One>(OPCODE_LOAD, r);
+  }
+};
+
+// registers[r] = acc
+template<int32_t r>
+struct Store {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    c->Write(s->registers[r]);
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<One>(OPCODE_STORE, r);
+  }
+};
+
+// acc += registers[r] * scale
+template<int32_t r, typename S>
+struct ReadRegister {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    c->Read(s->registers[r], S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S>(OPCODE_READ_REGISTER, r);
+  }
+};
+
+// acc += io[channel] * scale
+template<int32_t channel, typename S>
+struct ReadInput {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    c->Read(s->io[channel], S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S>(OPCODE_READ_INPUT, channel);
+  }
+};
+
+// acc += (io[0] + io[1]) * scale
+template<typename S>
+struct ReadMono {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    c->Read(s->io[0] + s->io[1], S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S>(OPCODE_READ_MONO, 0);
+  }
+};
+
+// acc += line[offset] * scale
+template<typename D, int32_t offset, typename S>
+struct Read {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    D d;
+    c->Read(d, offset, S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S, D>(OPCODE_READ, offset);
+  }
+};
+
+// line[offset] = acc, acc *= scale
+template<typename D, int32_t offset, typename S>
+struct Write {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    D d;
+    c->Write(d, offset, S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S, D>(OPCODE_WRITE, offset);
+  }
+};
+
+// line[offset] = acc, acc = acc * scale + last read
+template<typename D, int32_t offset, typename S>
+struct WriteAllPass {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    D d;
+    c->WriteAllPass(d, offset, S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S, D>(OPCODE_WRITE_ALL_PASS, offset);
+  }
+};
+
+// acc += line[offset + amplitude * lfo] * scale
+template<
+    typename D,
+    int32_t offset,
+    LFOIndex lfo,
+    int32_t amplitude,
+    typename S,
+    InterpolationMethod method = INTERPOLATION_LINEAR>
+struct Interpolate {
+  STATIC_ASSERT(method != INTERPOLATION_ALLPASS, allpass_requires_state);
+  
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    D d;
+    c->template Interpolate<method>(
+        d,
+        static_cast<float>(offset),
+        lfo,
+        static_cast<float>(amplitude),
+        S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    ProgramInstruction i = op::Describe<S, D>(OPCODE_INTERPOLATE, offset);
+    i.lfo = lfo;
+    i.amplitude = static_cast<float>(amplitude);
+    i.method = method;
+    return i;
+  }
+};
+
+// One-pole low-pass filtering of the accumulator.
+template<int32_t filter, typename S>
+struct Lp {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    c->Lp(s->filters[filter], S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S>(OPCODE_LP, filter);
+  }
+};
+
+// One-pole high-pass filtering of the accumulator.
+template<int32_t filter, typename S>
+struct Hp {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    c->Hp(s->filters[filter], S::value(s->k));
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S>(OPCODE_HP, filter);
+  }
+};
+
+// io[channel] += (acc - io[channel]) * scale, acc = 0
+template<int32_t channel, typename S>
+struct Crossfade {
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    float wet;
+    c->Write(wet, 0.0f);
+    s->io[channel] += (wet - s->io[channel]) * S::value(s->k);
+  }
+  static ProgramInstruction Describe() {
+    return op::Describe<S>(OPCODE_CROSSFADE, channel);
+  }
+};
+
+}  // namespace op
+
+template<typename... Ops>
+struct Program {
+  enum { size = sizeof...(Ops) };
+  STATIC_ASSERT(size <= kProgramMaxSize, program_too_long);
+  
+  // Runs the program for one sample. The braced list guarantees that the
+  // instructions are executed in order.
+  template<typename Context>
+  static inline void Run(Context* c, ProgramState* s) {
+    int unused[] = { 0, (Ops::template Run<Context>(c, s), 0)... };
+    (void)(unused);
+  }
+  
+  template<typename Engine>
+  static inline void Process(
+      Engine* engine,
+      ProgramState* s,
+      FloatFrame* in_out,
+      size_t size) {
+    typename Engine::Context c;
+    while (size--) {
+      engine->Start(&c);
+      s->io[0] = in_out->l;
+      s->io[1] = in_out->r;
+      Run(&c, s);
+      in_out->l = s->io[0];
+      in_out->r = s->io[1];
+      ++in_out;
+    }
+  }
+  
+  static inline size_t Assemble(ProgramInstruction* instructions) {
+    ProgramInstruction program[] = { Ops::Describe()... };
+    std::copy(&program[0], &program[size], &instructions[0]);
+    return size;
+  }
+};
+
+template<typename Engine>
+class ProgramInterpreter {
+ public:
+  typedef typename Engine::Context Context;
+  typedef typename Engine::Storage Storage;
+  
+  ProgramInterpreter() { }
+  ~ProgramInterpreter() { }
+  
+  void Init() {
+    size_ = 0;
+  }
+  
+  template<typename P>
+  void Load() {
+    size_ = P::Assemble(program_);
+  }
+  
+  // Rejects tables longer than kProgramMaxSize, or with an instruction the
+  // engine cannot execute - see Check().
+  bool Load(const ProgramInstruction* instructions, size_t size) {
+    if (size > kProgramMaxSize) {
+      return false;
+    }
+    for (size_t n = 0; n < size; ++n) {
+      if (!Check(instructions[n])) {
+        return false;
+      }
+    }
+    std::copy(&instructions[0], &instructions[size], &program_[0]);
+    size_ = size;
+    return true;
+  }
+  
+  void Process(
+      Engine* engine,
+      ProgramState* s,
+      FloatFrame* in_out,
+      size_t size) {
+    Context c;
+    while (size--) {
+      engine->Start(&c);
+      s->io[0] = in_out->l;
+      s->io[1] = in_out->r;
+      Run(&c, s);
+      in_out->l = s->io[0];
+      in_out->r = s->io[1];
+      ++in_out;
+    }
+  }
+  
+  // Each case runs the corresponding Context method, or the kernels it is
+  // made of when the delay line is only known at run time.
+  void Run(Context* c, ProgramState* s) const {
+    for (size_t n = 0; n < size_; ++n) {
+      const ProgramInstruction& i = program_[n];
+      const float scale = i.coefficient == -1
+          ? i.multiplier
+          : i.multiplier * s->k[i.coefficient];
+      switch (i.opcode) {
+        case OPCODE_LOAD:
+          c->Load(s->registers[i.operand]);
+          break;
+        
+        case OPCODE_STORE:
+          c->Write(s->registers[i.operand]);
+          break;
+        
+        case OPCODE_READ_REGISTER:
+          c->Read(s->registers[i.operand], scale);
+          break;
+        
+        case OPCODE_READ_INPUT:
+          c->Read(s->io[i.operand], scale);
+          break;
+        
+        case OPCODE_READ_MONO:
+          c->Read(s->io[0] + s->io[1], scale);
+          break;
+        
+        case OPCODE_READ:
+          c->Accumulate(
+              ACC_1,
+              Storage::Decompress(c->Cell(
+                  i.region, c->Position(i.base, i.length, i.offset))),
+              scale);
+          break;
+        
+        case OPCODE_WRITE:
+        case OPCODE_WRITE_ALL_PASS:
+          c->Store(
+              ACC_1,
+              c->Cell(i.region, c->Position(i.base, i.length, i.offset)),
+              scale);
+          if (i.opcode == OPCODE_WRITE_ALL_PASS) {
+            c->Read(c->previous_read_[ACC_1]);
+          }
+          break;
+        
+        case OPCODE_INTERPOLATE:
+          {
+            float offset = static_cast<float>(i.offset);
+            if (i.lfo != -1) {
+              offset += i.amplitude * c->lfo_value_[i.lfo];
+            }
+            c->Accumulate(
+                ACC_1, c->Tap(i.method, i.region, i.base, offset, NULL), scale);
+          }
+          break;
+        
+        case OPCODE_LP:
+          c->Lp(s->filters[i.operand], scale);
+          break;
+        
+        case OPCODE_HP:
+          c->Hp(s->filters[i.operand], scale);
+          break;
+        
+        case OPCODE_CROSSFADE:
+          {
+            float wet;
+            c->Write(wet, 0.0f);
+            s->io[i.operand] += (wet - s->io[i.operand]) * scale;
+          }
+          break;
+      }
+    }
+  }
+  
+  inline size_t size() const { return size_; }
+  
+ private:
+  // The interpreter only runs the stateless interpolation kernels, and reads
+  // the LFOs, registers, filters and coefficients that exist.
+  static bool Check(const ProgramInstruction& i) {
+    if (i.coefficient < -1 ||
+        i.coefficient >= static_cast<int32_t>(kProgramNumCoefficients)) {
+      return false;
+    }
+    switch (i.opcode) {
+      case OPCODE_LOAD:
+      case OPCODE_STORE:
+      case OPCODE_READ_REGISTER:
+        return i.operand >= 0 &&
+            i.operand < static_cast<int32_t>(kProgramNumRegisters);
+      
+      case OPCODE_READ_INPUT:
+      case OPCODE_CROSSFADE:
+        return i.operand == 0 || i.operand == 1;
+      
+      case OPCODE_READ_MONO:
+        return true;
+      
+      case OPCODE_LP:
+      case OPCODE_HP:
+        return i.operand >= 0 &&
+            i.operand < static_cast<int32_t>(kProgramNumFilters);
+      
+      case OPCODE_READ:
+      case OPCODE_WRITE:
+      case OPCODE_WRITE_ALL_PASS:
+        return CheckLine(i) && i.offset >= kTail && i.offset < i.length;
+      
+      case OPCODE_INTERPOLATE:
+        return CheckLine(i) &&
+            (i.method == INTERPOLATION_LINEAR ||
+             i.method == INTERPOLATION_HERMITE) &&
+            i.lfo >= -1 && i.lfo < static_cast<int32_t>(Engine::lfo_count) &&
+            CheckTaps(i);
+    }
+    return false;
+  }
+  
+  // The LFOs are in [0, 1], so the tap moves between offset and offset +
+  // amplitude. LINEAR reads the sample after it, HERMITE one sample before
+  // and two after. All of them must be inside the line, as for READ.
+  static bool CheckTaps(const ProgramInstruction& i) {
+    float lowest = static_cast<float>(i.offset);
+    float highest = lowest;
+    if (i.lfo != -1) {
+      lowest += std::min(i.amplitude, 0.0f);
+      highest += std::max(i.amplitude, 0.0f);
+    }
+    int32_t before = i.method == INTERPOLATION_HERMITE ? 1 : 0;
+    int32_t after = i.method == INTERPOLATION_HERMITE ? 2 : 1;
+    return lowest >= static_cast<float>(before) &&
+        highest < static_cast<float>(i.length - after);
+  }
+  
+  static bool CheckLine(const ProgramInstruction& i) {
+    int32_t capacity;
+    if (i.region == MEMORY_INTERNAL) {
+      capacity = Engine::internal_memory_size;
+    } else if (i.region == MEMORY_EXTERNAL) {
+      capacity = Engine::external_memory_size;
+    } else {
+      return false;
+    }
+    return i.base >= 0 && i.length > 0 && i.base + i.length <= capacity;
+  }
+  
+  ProgramInstruction program_[kProgramMaxSize];
+  size_t size_;
+  
+  DISALLOW_COPY_AND_ASSIGN(ProgramInterpreter);
+};
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_FX_FX_PROGRAM_H_
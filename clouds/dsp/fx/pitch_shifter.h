@@ -36,60 +36,100 @@
 
 namespace clouds {
 
+// The shifted signal is crossfaded with the dry signal over 64 samples when
+// the ratio leaves or returns to unity.
+const float kPitchShifterFadeIncrement = 1.0f / 64.0f;
+
+// Largest grain size, the length of the delay lines.
+const float kPitchShifterMaxSize = 2047.0f;
+
 class PitchShifter {
  public:
   PitchShifter() { }
   ~PitchShifter() { }
   
-  void Init(uint16_t* buffer) {
+  enum {
+    buffer_size = FxEngine<4096, FORMAT_16_BIT>::buffer_size
+  };
+  
+  void Init(uint16_t* buffer, float sample_rate) {
     engine_.Init(buffer);
     phase_ = 0;
-    size_ = 2047.0f;
+    size_ = kPitchShifterMaxSize;
+    size_coefficient_ = BlockCoefficient(0.05f, sample_rate);
+    ratio_ = 1.0f;
+    wet_ = 0.0f;
   }
   
   void Clear() {
     engine_.Clear();
   }
 
-  inline void Process(FloatFrame* input_output, size_t size) {
-    while (size--) {
-      Process(input_output);
-      ++input_output;
-    }
-  }
-  
-  void Process(FloatFrame* input_output) {
+  void Process(FloatFrame* input_output, size_t size) {
     typedef E::Reserve<2047, E::Reserve<2047> > Memory;
     E::DelayLine<Memory, 0> left;
     E::DelayLine<Memory, 1> right;
     E::Context c;
-    engine_.Start(&c);
     
-    phase_ += (1.0f - ratio_) / size_;
-    if (phase_ >= 1.0f) {
-      phase_ -= 1.0f;
-    }
-    if (phase_ <= 0.0f) {
-      phase_ += 1.0f;
-    }
-    float tri = 2.0f * (phase_ >= 0.5f ? 1.0f - phase_ : phase_);
-    float phase = phase_ * size_;
-    float half = phase + size_ * 0.5f;
-    if (half >= size_) {
-      half -= size_;
+    // At unity ratio, once the shifted signal has been faded out, the input
+    // is passed through untouched and nothing is read. It is still written,
+    // so that the lines hold recent audio when the shifter resumes.
+    const float wet_target = ratio_ == 1.0f ? 0.0f : 1.0f;
+    if (wet_ == 0.0f && wet_target == 0.0f) {
+      while (size--) {
+        engine_.Start(&c);
+        c.Read(input_output->l, 1.0f);
+        c.Write(left, 0.0f);
+        c.Read(input_output->r, 1.0f);
+        c.Write(right, 0.0f);
+        ++input_output;
+      }
+      return;
     }
     
-    c.Read(input_output->l, 1.0f);
-    c.Write(left, 0.0f);
-    c.Interpolate(left, phase, tri);
-    c.Interpolate(left, half, 1.0f - tri);
-    c.Write(input_output->l, 0.0f);
-
-    c.Read(input_output->r, 1.0f);
-    c.Write(right, 0.0f);
-    c.Interpolate(right, phase, tri);
-    c.Interpolate(right, half, 1.0f - tri);
-    c.Write(input_output->r, 0.0f);
+    const float wet_increment = wet_target == 1.0f
+        ? kPitchShifterFadeIncrement
+        : -kPitchShifterFadeIncrement;
+    while (size--) {
+      engine_.Start(&c);
+      
+      phase_ += (1.0f - ratio_) / size_;
+      if (phase_ >= 1.0f) {
+        phase_ -= 1.0f;
+      }
+      if (phase_ <= 0.0f) {
+        phase_ += 1.0f;
+      }
+      float tri = 2.0f * (phase_ >= 0.5f ? 1.0f - phase_ : phase_);
+      float phase = phase_ * size_;
+      float half = phase + size_ * 0.5f;
+      if (half >= size_) {
+        half -= size_;
+      }
+      
+      float l = input_output->l;
+      float r = input_output->r;
+      
+      c.Read(l, 1.0f);
+      c.Write(left, 0.0f);
+      c.Interpolate(left, phase, tri);
+      c.Interpolate(left, half, 1.0f - tri);
+      c.Write(input_output->l, 0.0f);
+      
+      c.Read(r, 1.0f);
+      c.Write(right, 0.0f);
+      c.Interpolate(right, phase, tri);
+      c.Interpolate(right, half, 1.0f - tri);
+      c.Write(input_output->r, 0.0f);
+      
+      if (wet_ != 1.0f || wet_target != 1.0f) {
+        wet_ += wet_increment;
+        CONSTRAIN(wet_, 0.0f, 1.0f);
+        input_output->l = l + (input_output->l - l) * wet_;
+        input_output->r = r + (input_output->r - r) * wet_;
+      }
+      ++input_output;
+    }
   }
   
   inline void set_ratio(float ratio) {
@@ -97,8 +137,9 @@ class PitchShifter {
   }
   
   inline void set_size(float size) {
-    float target_size = 128.0f + (2047.0f - 128.0f) * size * size * size;
-    ONE_POLE(size_, target_size, 0.05f)
+    float target_size = 128.0f + \
+        (kPitchShifterMaxSize - 128.0f) * size * size * size;
+    ONE_POLE(size_, target_size, size_coefficient_)
   }
   
  private:
@@ -107,6 +148,8 @@ class PitchShifter {
   float phase_;
   float ratio_;
   float size_;
+  float size_coefficient_;
+  float wet_;
   
   DISALLOW_COPY_AND_ASSIGN(PitchShifter);
 };
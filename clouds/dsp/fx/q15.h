@@ -0,0 +1,88 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Packed 16-bit fixed point helpers. On Cortex-M cores with the DSP extension
+// they map to single instructions (SMLAD, SSAT); elsewhere they are emulated
+// with the same results, to test fixed point code on the host.
+
+#ifndef CLOUDS_DSP_FX_Q15_H_
+#define CLOUDS_DSP_FX_Q15_H_
+
+#include <cstring>
+
+#include "stmlib/stmlib.h"
+
+#ifdef __ARM_FEATURE_DSP
+#include <arm_acle.h>
+#endif  // __ARM_FEATURE_DSP
+
+namespace clouds {
+
+// Two signed 16-bit values packed in a word, low half first.
+inline uint32_t Pack16(int16_t low, int16_t high) {
+  return static_cast<uint16_t>(low) | \
+      (static_cast<uint32_t>(static_cast<uint16_t>(high)) << 16);
+}
+
+// Loads two consecutive 16-bit samples with a single (possibly unaligned)
+// access.
+inline uint32_t Load16x2(const uint16_t* p) {
+  uint32_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+// acc + x.low * y.low + x.high * y.high.
+inline int32_t Smlad(uint32_t x, uint32_t y, int32_t acc) {
+#ifdef __ARM_FEATURE_DSP
+  return __smlad(x, y, acc);
+#else
+  int32_t low = static_cast<int16_t>(x) * static_cast<int16_t>(y);
+  int32_t high = static_cast<int16_t>(x >> 16) * static_cast<int16_t>(y >> 16);
+  return static_cast<int32_t>(
+      static_cast<uint32_t>(acc) + \
+      static_cast<uint32_t>(low) + \
+      static_cast<uint32_t>(high));
+#endif  // __ARM_FEATURE_DSP
+}
+
+// Saturates to the int16_t range.
+inline int32_t Ssat16(int32_t x) {
+#ifdef __ARM_FEATURE_DSP
+  return __ssat(x, 16);
+#else
+  return x > 32767 ? 32767 : (x < -32768 ? -32768 : x);
+#endif  // __ARM_FEATURE_DSP
+}
+
+// Q15 representation of a coefficient in [-1, 1].
+inline int16_t Q15(float x) {
+  return static_cast<int16_t>(Ssat16(static_cast<int32_t>(x * 32768.0f)));
+}
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_FX_Q15_H_
@@ -29,8 +29,11 @@
 #ifndef CLOUDS_DSP_FX_REVERB_H_
 #define CLOUDS_DSP_FX_REVERB_H_
 
+#include <cmath>
+
 #include "clouds/stmlib/stmlib.h"
 
+#include "clouds/dsp/frame.h"
 #include "clouds/dsp/fx/fx_engine.h"
 
 namespace clouds {
@@ -40,12 +43,22 @@ class Reverb {
   Reverb() { }
   ~Reverb() { }
   
-  void Init(uint16_t* buffer) {
+  enum {
+    buffer_size = FxEngine<16384, FORMAT_12_BIT, 2, 1024, 0, 2>::buffer_size
+  };
+  
+  // The delay lengths are in samples and are not rescaled; the LFOs, the
+  // decay and the damping are, so that the reverb keeps its time and its
+  // tone at other sample rates.
+  void Init(uint16_t* buffer, float sample_rate) {
     engine_.Init(buffer);
-    engine_.SetLFOFrequency(LFO_1, 0.5f / 32000.0f);
-    engine_.SetLFOFrequency(LFO_2, 0.3f / 32000.0f);
+    engine_.SetLFOFrequency(LFO_1, 0.5f / sample_rate);
+    engine_.SetLFOFrequency(LFO_2, 0.3f / sample_rate);
+    rate_exponent_ = kNativeSampleRate / sample_rate;
     lp_ = 0.7f;
     diffusion_ = 0.625f;
+    lp_decay_1_ = 0.0f;
+    lp_decay_2_ = 0.0f;
   }
   
   void Process(FloatFrame* in_out, size_t size) {
@@ -53,10 +66,12 @@ class Reverb {
     // (4 AP diffusers on the input, then a loop of 2x 2AP+1Delay).
     // Modulation is applied in the loop of the first diffuser AP for additional
     // smearing; and to the two long delays for a slow shimmer/chorus effect.
-    typedef E::Reserve<113,
-      E::Reserve<162,
-      E::Reserve<241,
-      E::Reserve<399,
+    // The short input diffusers are accessed twice per sample and are kept
+    // in the engine's internal memory.
+    typedef E::InternalReserve<113,
+      E::InternalReserve<162,
+      E::InternalReserve<241,
+      E::InternalReserve<399,
       E::Reserve<1653,
       E::Reserve<2038,
       E::Reserve<3411,
@@ -85,7 +100,8 @@ class Reverb {
     float lp_2 = lp_decay_2_;
 
     while (size--) {
-      float wet;
+      float wet_l;
+      float wet_r;
       float apout = 0.0f;
       engine_.Start(&c);
       
@@ -106,31 +122,31 @@ class Reverb {
       c.WriteAllPass(ap4, -kap);
       c.Write(apout);
       
-      // Main reverb loop.
-      c.Load(apout);
-      c.Interpolate(del2, 4680.0f, LFO_2, 100.0f, krt);
-      c.Lp(lp_1, klp);
-      c.Read(dap1a TAIL, -kap);
-      c.WriteAllPass(dap1a, kap);
-      c.Read(dap1b TAIL, kap);
-      c.WriteAllPass(dap1b, -kap);
-      c.Write(del1, 2.0f);
-      c.Write(wet, 0.0f);
-
-      in_out->l += (wet - in_out->l) * amount;
+      // Main reverb loop. The two halves only interact through the delay
+      // memory, at addresses which do not overlap, so they are computed in
+      // two accumulators and interleaved.
+      c.Load<ACC_1>(apout);
+      c.Load<ACC_2>(apout);
+      c.Interpolate<ACC_1>(del2, 4680.0f, LFO_2, 100.0f, krt);
+      // c.Interpolate<ACC_2>(del1, 4450.0f, LFO_1, 50.0f, krt);
+      c.Read<ACC_2>(del1 TAIL, krt);
+      c.Lp<ACC_1>(lp_1, klp);
+      c.Lp<ACC_2>(lp_2, klp);
+      c.Read<ACC_1>(dap1a TAIL, -kap);
+      c.Read<ACC_2>(dap2a TAIL, kap);
+      c.WriteAllPass<ACC_1>(dap1a, kap);
+      c.WriteAllPass<ACC_2>(dap2a, -kap);
+      c.Read<ACC_1>(dap1b TAIL, kap);
+      c.Read<ACC_2>(dap2b TAIL, -kap);
+      c.WriteAllPass<ACC_1>(dap1b, -kap);
+      c.WriteAllPass<ACC_2>(dap2b, kap);
+      c.Write<ACC_1>(del1, 2.0f);
+      c.Write<ACC_2>(del2, 2.0f);
+      c.Write<ACC_1>(wet_l, 0.0f);
+      c.Write<ACC_2>(wet_r, 0.0f);
 
-      c.Load(apout);
-      // c.Interpolate(del1, 4450.0f, LFO_1, 50.0f, krt);
-      c.Read(del1 TAIL, krt);
-      c.Lp(lp_2, klp);
-      c.Read(dap2a TAIL, kap);
-      c.WriteAllPass(dap2a, -kap);
-      c.Read(dap2b TAIL, -kap);
-      c.WriteAllPass(dap2b, kap);
-      c.Write(del2, 2.0f);
-      c.Write(wet, 0.0f);
-
-      in_out->r += (wet - in_out->r) * amount;
+      in_out->l += (wet_l - in_out->l) * amount;
+      in_out->r += (wet_r - in_out->r) * amount;
       
       ++in_out;
     }
@@ -148,7 +164,7 @@ class Reverb {
   }
 
   inline void set_time(float reverb_time) {
-    reverb_time_ = reverb_time;
+    reverb_time_ = RescaleGain(reverb_time);
   }
   
   inline void set_diffusion(float diffusion) {
@@ -156,17 +172,25 @@ class Reverb {
   }
   
   inline void set_lp(float lp) {
-    lp_ = lp;
+    lp_ = 1.0f - RescaleGain(1.0f - lp);
   }
   
  private:
-  typedef FxEngine<16384, FORMAT_12_BIT> E;
+  // A gain applied once per sample (or per trip around the loop) at the
+  // native rate, turned into the gain with the same effect per second.
+  inline float RescaleGain(float gain) const {
+    return rate_exponent_ == 1.0f ? gain : powf(gain, rate_exponent_);
+  }
+  
+  // The two halves of the loop run on two accumulators.
+  typedef FxEngine<16384, FORMAT_12_BIT, 2, 1024, 0, 2> E;
   E engine_;
   
   float amount_;
   float input_gain_;
   float reverb_time_;
   float diffusion_;
+  float rate_exponent_;
   float lp_;
   
   float lp_decay_1_;
@@ -33,7 +33,6 @@
 #include "clouds/drivers/debug_pin.h"
 
 #include "stmlib/dsp/parameter_interpolator.h"
-#include "stmlib/utils/buffer_allocator.h"
 
 #include "clouds/resources.h"
 
@@ -44,23 +43,40 @@ using namespace stmlib;
 
 void GranularProcessor::Init(
     void* large_buffer, size_t large_buffer_size,
-    void* small_buffer, size_t small_buffer_size) {
+    void* small_buffer, size_t small_buffer_size,
+    float sample_rate) {
   buffer_[0] = large_buffer;
   buffer_[1] = small_buffer;
   buffer_size_[0] = large_buffer_size;
   buffer_size_[1] = small_buffer_size;
+  sample_rate_ = sample_rate;
+  prepare_budget_ = 0;
+  parameter_channel_ = NULL;
   
   num_channels_ = 2;
   low_fidelity_ = false;
   bypass_ = false;
+  silence_ = false;
+  freeze_lp_ = 0.0f;
+  freeze_coefficient_ = BlockCoefficient(0.0005f, sample_rate);
+  dirty_coefficients_ = COEFFICIENTS_ALL;
+  mode_fade_ = 1.0f;
+  mode_fade_increment_ = 1.0f / (kPlaybackModeFadeTime * sample_rate);
+  mode_crossfade_ = 0.0f;
   
   src_down_.Init();
   src_up_.Init();
   
   ResetFilters();
+  // The feedback path is read before the first block writes it.
+  for (size_t i = 0; i < kMaxBlockSize; ++i) {
+    fb_[i].l = fb_[i].r = 0.0f;
+  }
   
   previous_playback_mode_ = PLAYBACK_MODE_LAST;
+  next_playback_mode_ = PLAYBACK_MODE_LAST;
   reset_buffers_ = true;
+  reallocation_step_ = REALLOCATION_NONE;
   dry_wet_ = 0.0f;
 }
 
@@ -70,15 +86,18 @@ void GranularProcessor::ResetFilters() {
     lp_filter_[i].Init();
     hp_filter_[i].Init();
   }
+  dirty_coefficients_ |= COEFFICIENTS_FEEDBACK_FILTER | COEFFICIENTS_FILTERS;
 }
 
 void GranularProcessor::ProcessGranular(
     FloatFrame* input,
     FloatFrame* output,
-    size_t size) {
+    size_t size,
+    float crossfade_start,
+    float crossfade_end) {
   // At the exception of the spectral mode, all modes require the incoming
   // audio signal to be written to the recording buffer.
-  if (playback_mode_ != PLAYBACK_MODE_SPECTRAL) {
+  if (previous_playback_mode_ != PLAYBACK_MODE_SPECTRAL) {
     const float* input_samples = &input[0].l;
     for (int32_t i = 0; i < num_channels_; ++i) {
       if (resolution() == 8) {
@@ -91,7 +110,32 @@ void GranularProcessor::ProcessGranular(
     }
   }
   
-  switch (playback_mode_) {
+  Play(previous_playback_mode_, input, output, size);
+  if (!crossfading()) {
+    return;
+  }
+  
+  // Both players read the same recording, and are crossfaded with an
+  // equal-power curve. The position stays below 1, past which the lookups
+  // would read beyond the end of the tables.
+  Play(next_playback_mode_, input, crossfade_, size);
+  float t = crossfade_start;
+  float increment = (crossfade_end - crossfade_start) / size;
+  for (size_t i = 0; i < size; ++i) {
+    float fade_in = 1.414213562f * Interpolate(lut_xfade_in, t, 16.0f);
+    float fade_out = 1.414213562f * Interpolate(lut_xfade_out, t, 16.0f);
+    t += increment;
+    output[i].l = output[i].l * fade_out + crossfade_[i].l * fade_in;
+    output[i].r = output[i].r * fade_out + crossfade_[i].r * fade_in;
+  }
+}
+
+void GranularProcessor::Play(
+    PlaybackMode mode,
+    FloatFrame* input,
+    FloatFrame* output,
+    size_t size) {
+  switch (mode) {
     case PLAYBACK_MODE_GRANULAR:
       // In Granular mode, DENSITY is a meta parameter.
       parameters_.granular.use_deterministic_seed = parameters_.density < 0.5f;
@@ -160,130 +204,349 @@ void GranularProcessor::Process(
     ShortFrame* input,
     ShortFrame* output,
     size_t size) {
-  // TIC
+  // Adapter for the codec: the samples are converted to and from float, and
+  // processed by the float version one block at a time.
+  if (parameter_channel_) {
+    parameter_channel_->Acquire(&parameters_);
+  }
   if (bypass_) {
     copy(&input[0], &input[size], &output[0]);
     return;
   }
   
-  if (silence_ || reset_buffers_ ||
-      previous_playback_mode_ != playback_mode_) {
-    short* output_samples = &output[0].l;
-    fill(&output_samples[0], &output_samples[size << 1], 0);
+  float input_samples[kMaxBlockSize * 2];
+  float output_samples[kMaxBlockSize * 2];
+  while (size) {
+    size_t block_size = min(size, kMaxBlockSize);
+    const short* s = &input[0].l;
+    for (size_t i = 0; i < block_size * 2; ++i) {
+      input_samples[i] = static_cast<float>(s[i]) / 32768.0f;
+    }
+    ProcessBlock(input_samples, output_samples, block_size);
+    short* d = &output[0].l;
+    for (size_t i = 0; i < block_size * 2; ++i) {
+      d[i] = Clip16(static_cast<int32_t>(output_samples[i] * 32768.0f));
+    }
+    input += block_size;
+    output += block_size;
+    size -= block_size;
+  }
+  if (prepare_budget_) {
+    Prepare(prepare_budget_);
+  }
+}
+
+void GranularProcessor::Process(
+    const float* input,
+    float* output,
+    size_t size) {
+  if (parameter_channel_) {
+    parameter_channel_->Acquire(&parameters_);
+  }
+  while (size) {
+    size_t block_size = min(size, kMaxBlockSize);
+    ProcessBlock(input, output, block_size);
+    input += block_size * 2;
+    output += block_size * 2;
+    size -= block_size;
+  }
+  if (prepare_budget_) {
+    Prepare(prepare_budget_);
+  }
+}
+
+void GranularProcessor::ProcessBlock(
+    const float* input,
+    float* output,
+    size_t size) {
+  STATIC_ASSERT(
+      kMaxBlockSize % kDownsamplingFactor == 0,
+      block_size_must_be_a_multiple_of_downsampling_factor);
+  // TIC
+  if (bypass_) {
+    copy(&input[0], &input[size * 2], &output[0]);
     return;
   }
   
-  // Convert input buffers to float, and mixdown for mono processing.
-  for (size_t i = 0; i < size; ++i) {
-    in_[i].l = static_cast<float>(input[i].l) / 32768.0f;
-    in_[i].r = static_cast<float>(input[i].r) / 32768.0f;
+  if (silence_ || reset_buffers_) {
+    fill(&output[0], &output[size * 2], 0.0f);
+    return;
   }
-  if (num_channels_ == 1) {
+  
+  if ((playback_mode_change_staged() && mode_fade_ == 0.0f) ||
+      reallocating()) {
+    // The previous mode has faded out, and its buffers are left alone until
+    // Prepare() has reallocated them. Only the dry signal is heard.
     for (size_t i = 0; i < size; ++i) {
-      in_[i].l = (in_[i].l + in_[i].r) * 0.5f;
-      in_[i].r = in_[i].l;
+      out_[i].l = out_[i].r = 0.0f;
+      fb_[i].l = fb_[i].r = 0.0f;
     }
+    MixOutput(input, output, size);
+    return;
   }
   
-  // Apply feedback, with high-pass filtering to prevent build-ups at very
-  // low frequencies (causing large DC swings).
-  ONE_POLE(freeze_lp_, parameters_.freeze ? 1.0f : 0.0f, 0.0005f)
+  if (!crossfading() && previous_playback_mode_ != playback_mode_ &&
+      !playback_mode_change_reallocates()) {
+    StartCrossfade();
+  }
+  float crossfade_start = mode_crossfade_;
+  if (crossfading()) {
+    mode_crossfade_ += mode_fade_increment_ * static_cast<float>(size);
+    if (mode_crossfade_ > 1.0f) {
+      mode_crossfade_ = 1.0f;
+    }
+  }
+  float crossfade_end = mode_crossfade_;
+  
+  // Deinterleave the input, mix it down for mono processing, and apply
+  // feedback, with high-pass filtering to prevent build-ups at very low
+  // frequencies (causing large DC swings). This is done in a single pass.
+  ONE_POLE(freeze_lp_, parameters_.freeze ? 1.0f : 0.0f, freeze_coefficient_)
   float feedback = parameters_.feedback;
-  float cutoff = (20.0f + 100.0f * feedback * feedback) / sample_rate();
-  fb_filter_[0].set_f_q<FREQUENCY_FAST>(cutoff, 1.0f);
-  fb_filter_[1].set(fb_filter_[0]);
-  fb_filter_[0].Process<FILTER_MODE_HIGH_PASS>(&fb_[0].l, &fb_[0].l, size, 2);
-  fb_filter_[1].Process<FILTER_MODE_HIGH_PASS>(&fb_[0].r, &fb_[0].r, size, 2);
+  if ((dirty_coefficients_ & COEFFICIENTS_FEEDBACK_FILTER) ||
+      feedback != feedback_filter_feedback_) {
+    float cutoff = (20.0f + 100.0f * feedback * feedback) / sample_rate();
+    fb_filter_[0].set_f_q<FREQUENCY_FAST>(cutoff, 1.0f);
+    fb_filter_[1].set(fb_filter_[0]);
+    feedback_filter_feedback_ = feedback;
+    dirty_coefficients_ &= ~COEFFICIENTS_FEEDBACK_FILTER;
+  }
   float fb_gain = feedback * (1.0f - freeze_lp_);
+  bool mono = num_channels_ == 1;
   for (size_t i = 0; i < size; ++i) {
-    in_[i].l += fb_gain * (
-        SoftLimit(fb_gain * 1.4f * fb_[i].l + in_[i].l) - in_[i].l);
-    in_[i].r += fb_gain * (
-        SoftLimit(fb_gain * 1.4f * fb_[i].r + in_[i].r) - in_[i].r);
+    float l = input[2 * i];
+    float r = input[2 * i + 1];
+    if (mono) {
+      l = (l + r) * 0.5f;
+      r = l;
+    }
+    float fb_l = fb_filter_[0].Process<FILTER_MODE_HIGH_PASS>(fb_[i].l);
+    float fb_r = fb_filter_[1].Process<FILTER_MODE_HIGH_PASS>(fb_[i].r);
+    in_[i].l = l + fb_gain * (SoftLimit(fb_gain * 1.4f * fb_l + l) - l);
+    in_[i].r = r + fb_gain * (SoftLimit(fb_gain * 1.4f * fb_r + r) - r);
   }
   
   if (low_fidelity_) {
     size_t downsampled_size = size / kDownsamplingFactor;
     src_down_.Process(in_, in_downsampled_,size);
-    ProcessGranular(in_downsampled_, out_downsampled_, downsampled_size);
+    ProcessGranular(
+        in_downsampled_,
+        out_downsampled_,
+        downsampled_size,
+        crossfade_start,
+        crossfade_end);
     src_up_.Process(out_downsampled_, out_, downsampled_size);
   } else {
-    ProcessGranular(in_, out_, size);
+    ProcessGranular(in_, out_, size, crossfade_start, crossfade_end);
   }
   
-  // Diffusion and pitch-shifting post-processings.
-  if (playback_mode_ != PLAYBACK_MODE_SPECTRAL) {
-    float texture = parameters_.texture;
-    float diffusion = playback_mode_ == PLAYBACK_MODE_GRANULAR 
-        ? texture > 0.75f ? (texture - 0.75f) * 4.0f : 0.0f
-        : parameters_.density;
+  // Diffusion and pitch-shifting post-processings. While crossfading, they
+  // process the mix of the two players, and the effects used by only one of
+  // the modes are mixed in with the share of that mode.
+  if (previous_playback_mode_ != PLAYBACK_MODE_SPECTRAL) {
+    float diffusion = Diffusion(previous_playback_mode_);
+    if (crossfading()) {
+      diffusion += (Diffusion(next_playback_mode_) - diffusion) * \
+          crossfade_end;
+    }
     diffuser_.set_amount(diffusion);
     diffuser_.Process(out_, size);
   }
   
-  if (playback_mode_ == PLAYBACK_MODE_LOOPING_DELAY &&
+  bool previous_shifted = \
+      previous_playback_mode_ == PLAYBACK_MODE_LOOPING_DELAY;
+  bool next_shifted = next_playback_mode_ == PLAYBACK_MODE_LOOPING_DELAY;
+  if ((previous_shifted || next_shifted) &&
       (!parameters_.freeze || looper_.synchronized())) {
-    pitch_shifter_.set_ratio(SemitonesToRatio(parameters_.pitch));
+    if ((dirty_coefficients_ & COEFFICIENTS_PITCH_SHIFTER) ||
+        parameters_.pitch != pitch_shifter_pitch_) {
+      pitch_shifter_.set_ratio(SemitonesToRatio(parameters_.pitch));
+      pitch_shifter_pitch_ = parameters_.pitch;
+      dirty_coefficients_ &= ~COEFFICIENTS_PITCH_SHIFTER;
+    }
     pitch_shifter_.set_size(parameters_.size);
-    pitch_shifter_.Process(out_, size);
+    if (previous_shifted && next_shifted) {
+      pitch_shifter_.Process(out_, size);
+    } else {
+      copy(&out_[0], &out_[size], &crossfade_[0]);
+      pitch_shifter_.Process(crossfade_, size);
+      MixWet(
+          Share(previous_shifted, next_shifted, crossfade_start),
+          Share(previous_shifted, next_shifted, crossfade_end),
+          size);
+    }
   }
   
-  // Apply filters.
-  if (playback_mode_ == PLAYBACK_MODE_LOOPING_DELAY ||
-      playback_mode_ == PLAYBACK_MODE_STRETCH) {
-    float cutoff = parameters_.texture;
-    float lp_cutoff = 0.5f * SemitonesToRatio(
-        (cutoff < 0.5f ? cutoff - 0.5f : 0.0f) * 216.0f);
-    float hp_cutoff = 0.25f * SemitonesToRatio(
-        (cutoff < 0.5f ? -0.5f : cutoff - 1.0f) * 216.0f);
-    CONSTRAIN(lp_cutoff, 0.0f, 0.499f);
-    CONSTRAIN(hp_cutoff, 0.0f, 0.499f);
-    float lpq = 1.0f + 3.0f * (1.0f - feedback) * (0.5f - lp_cutoff);
-    lp_filter_[0].set_f_q<FREQUENCY_FAST>(lp_cutoff, lpq);
-    lp_filter_[0].Process<FILTER_MODE_LOW_PASS>(
-        &out_[0].l, &out_[0].l, size, 2);
-
-    lp_filter_[1].set(lp_filter_[0]);
-    lp_filter_[1].Process<FILTER_MODE_LOW_PASS>(
-        &out_[0].r, &out_[0].r, size, 2);
-
-    hp_filter_[0].set_f_q<FREQUENCY_FAST>(hp_cutoff, 1.0f);
-    hp_filter_[0].Process<FILTER_MODE_HIGH_PASS>(
-        &out_[0].l, &out_[0].l, size, 2);
-
-    hp_filter_[1].set(hp_filter_[0]);
-    hp_filter_[1].Process<FILTER_MODE_HIGH_PASS>(
-        &out_[0].r, &out_[0].r, size, 2);
+  // Apply filters, and keep what is fed back, in a single pass. Reverb is
+  // not fed back.
+  bool previous_filtered = filtered(previous_playback_mode_);
+  bool next_filtered = filtered(next_playback_mode_);
+  if (previous_filtered || next_filtered) {
+    if ((dirty_coefficients_ & COEFFICIENTS_FILTERS) ||
+        parameters_.texture != filters_texture_ ||
+        feedback != filters_feedback_) {
+      float cutoff = parameters_.texture;
+      float lp_cutoff = 0.5f * SemitonesToRatio(
+          (cutoff < 0.5f ? cutoff - 0.5f : 0.0f) * 216.0f);
+      float hp_cutoff = 0.25f * SemitonesToRatio(
+          (cutoff < 0.5f ? -0.5f : cutoff - 1.0f) * 216.0f);
+      // The cutoffs above are relative to the native sample rate.
+      const float rate_ratio = kNativeSampleRate / sample_rate_;
+      lp_cutoff *= rate_ratio;
+      hp_cutoff *= rate_ratio;
+      CONSTRAIN(lp_cutoff, 0.0f, 0.499f);
+      CONSTRAIN(hp_cutoff, 0.0f, 0.499f);
+      float lpq = 1.0f + 3.0f * (1.0f - feedback) * (0.5f - lp_cutoff);
+      lp_filter_[0].set_f_q<FREQUENCY_FAST>(lp_cutoff, lpq);
+      lp_filter_[1].set(lp_filter_[0]);
+      hp_filter_[0].set_f_q<FREQUENCY_FAST>(hp_cutoff, 1.0f);
+      hp_filter_[1].set(hp_filter_[0]);
+      filters_texture_ = parameters_.texture;
+      filters_feedback_ = feedback;
+      dirty_coefficients_ &= ~COEFFICIENTS_FILTERS;
+    }
+    if (previous_filtered && next_filtered) {
+      for (size_t i = 0; i < size; ++i) {
+        float l = lp_filter_[0].Process<FILTER_MODE_LOW_PASS>(out_[i].l);
+        float r = lp_filter_[1].Process<FILTER_MODE_LOW_PASS>(out_[i].r);
+        l = hp_filter_[0].Process<FILTER_MODE_HIGH_PASS>(l);
+        r = hp_filter_[1].Process<FILTER_MODE_HIGH_PASS>(r);
+        out_[i].l = fb_[i].l = l;
+        out_[i].r = fb_[i].r = r;
+      }
+    } else {
+      for (size_t i = 0; i < size; ++i) {
+        float l = lp_filter_[0].Process<FILTER_MODE_LOW_PASS>(out_[i].l);
+        float r = lp_filter_[1].Process<FILTER_MODE_LOW_PASS>(out_[i].r);
+        crossfade_[i].l = hp_filter_[0].Process<FILTER_MODE_HIGH_PASS>(l);
+        crossfade_[i].r = hp_filter_[1].Process<FILTER_MODE_HIGH_PASS>(r);
+      }
+      MixWet(
+          Share(previous_filtered, next_filtered, crossfade_start),
+          Share(previous_filtered, next_filtered, crossfade_end),
+          size);
+      copy(&out_[0], &out_[size], &fb_[0]);
+    }
+  } else {
+    copy(&out_[0], &out_[size], &fb_[0]);
   }
   
-  // This is what is fed back. Reverb is not fed back.
-  copy(&out_[0], &out_[size], &fb_[0]);
-  
   // Apply reverb.
   float reverb_amount = parameters_.reverb * 0.95f;
   reverb_amount += feedback * (2.0f - feedback) * freeze_lp_;
   CONSTRAIN(reverb_amount, 0.0f, 1.0f);
   
-  reverb_.set_amount(reverb_amount * 0.54f);
-  reverb_.set_diffusion(0.7f);
-  reverb_.set_time(0.35f + 0.63f * reverb_amount);
-  reverb_.set_input_gain(0.2f);
-  reverb_.set_lp(0.6f + 0.37f * feedback);
+  if ((dirty_coefficients_ & COEFFICIENTS_REVERB) ||
+      reverb_amount != reverb_amount_ ||
+      feedback != reverb_feedback_) {
+    reverb_.set_amount(reverb_amount * 0.54f);
+    reverb_.set_diffusion(0.7f);
+    reverb_.set_time(0.35f + 0.63f * reverb_amount);
+    reverb_.set_input_gain(0.2f);
+    reverb_.set_lp(0.6f + 0.37f * feedback);
+    reverb_amount_ = reverb_amount;
+    reverb_feedback_ = feedback;
+    dirty_coefficients_ &= ~COEFFICIENTS_REVERB;
+  }
   reverb_.Process(out_, size);
   
+  MixOutput(input, output, size);
+  
+  if (crossfading() && mode_crossfade_ == 1.0f) {
+    previous_playback_mode_ = next_playback_mode_;
+  }
+}
+
+void GranularProcessor::StartCrossfade() {
+  next_playback_mode_ = playback_mode_;
+  mode_crossfade_ = 0.0f;
+  // The effects the previous mode did not use have stale states - and the
+  // pitch shifter memory is shared with the correlator.
+  if (!filtered(previous_playback_mode_)) {
+    ResetFilters();
+  }
+  if (next_playback_mode_ == PLAYBACK_MODE_LOOPING_DELAY) {
+    pitch_shifter_.Clear();
+  }
+}
+
+float GranularProcessor::Diffusion(PlaybackMode mode) const {
+  float texture = parameters_.texture;
+  return mode == PLAYBACK_MODE_GRANULAR 
+      ? texture > 0.75f ? (texture - 0.75f) * 4.0f : 0.0f
+      : parameters_.density;
+}
+
+// Mixes the wet signal of an effect, in crossfade_, into out_ with a share
+// going from start to end over the block.
+void GranularProcessor::MixWet(float start, float end, size_t size) {
+  float share = start;
+  float increment = (end - start) / size;
+  for (size_t i = 0; i < size; ++i) {
+    share += increment;
+    out_[i].l += (crossfade_[i].l - out_[i].l) * share;
+    out_[i].r += (crossfade_[i].r - out_[i].r) * share;
+  }
+}
+
+void GranularProcessor::MixOutput(
+    const float* input,
+    float* output,
+    size_t size) {
   const float post_gain = 1.2f;
+  bool switching = playback_mode_change_staged() || reallocating();
+  if (!switching && mode_fade_ == 1.0f) {
+    if (dry_wet_ == parameters_.dry_wet) {
+      // The crossfade has settled: its gains are looked up once per block.
+      float fade_in = Interpolate(lut_xfade_in, dry_wet_, 16.0f);
+      float fade_out = Interpolate(lut_xfade_out, dry_wet_, 16.0f);
+      for (size_t i = 0; i < size; ++i) {
+        float l = input[2 * i] * fade_out;
+        float r = input[2 * i + 1] * fade_out;
+        l += out_[i].l * post_gain * fade_in;
+        r += out_[i].r * post_gain * fade_in;
+        output[2 * i] = SoftClip(l * 0.5f);
+        output[2 * i + 1] = SoftClip(r * 0.5f);
+      }
+      return;
+    }
+  
+    ParameterInterpolator dry_wet_mod(&dry_wet_, parameters_.dry_wet, size);
+    for (size_t i = 0; i < size; ++i) {
+      float dry_wet = dry_wet_mod.Next();
+      float fade_in = Interpolate(lut_xfade_in, dry_wet, 16.0f);
+      float fade_out = Interpolate(lut_xfade_out, dry_wet, 16.0f);
+      float l = input[2 * i] * fade_out;
+      float r = input[2 * i + 1] * fade_out;
+      l += out_[i].l * post_gain * fade_in;
+      r += out_[i].r * post_gain * fade_in;
+      output[2 * i] = SoftClip(l * 0.5f);
+      output[2 * i + 1] = SoftClip(r * 0.5f);
+    }
+    return;
+  }
+  
+  // Around a change to or from the spectral mode, the wet signal fades out,
+  // then in.
+  float mode_fade = mode_fade_;
+  float mode_fade_increment = switching
+      ? -mode_fade_increment_
+      : mode_fade_increment_;
   ParameterInterpolator dry_wet_mod(&dry_wet_, parameters_.dry_wet, size);
   for (size_t i = 0; i < size; ++i) {
+    mode_fade += mode_fade_increment;
+    CONSTRAIN(mode_fade, 0.0f, 1.0f);
     float dry_wet = dry_wet_mod.Next();
-    float fade_in = Interpolate(lut_xfade_in, dry_wet, 16.0f);
+    float fade_in = Interpolate(lut_xfade_in, dry_wet, 16.0f) * mode_fade;
     float fade_out = Interpolate(lut_xfade_out, dry_wet, 16.0f);
-    float l = static_cast<float>(input[i].l) / 32768.0f * fade_out;
-    float r = static_cast<float>(input[i].r) / 32768.0f * fade_out;
+    float l = input[2 * i] * fade_out;
+    float r = input[2 * i + 1] * fade_out;
     l += out_[i].l * post_gain * fade_in;
     r += out_[i].r * post_gain * fade_in;
-    output[i].l = SoftConvert(l);
-    output[i].r = SoftConvert(r);
+    output[2 * i] = SoftClip(l * 0.5f);
+    output[2 * i + 1] = SoftClip(r * 0.5f);
   }
+  mode_fade_ = mode_fade;
 }
 
 void GranularProcessor::PreparePersistentData() {
@@ -302,13 +565,17 @@ void GranularProcessor::GetPersistentData(
   block->tag = FourCC<'s', 't', 'a', 't'>::value;
   block->data = &persistent_state_;
   block->size = sizeof(PersistentState);
+  block->compressed = false;
   ++block;
 
-  // Create save block holding the audio buffers.
+  // Create save block holding the audio buffers. 16-bit buffers are
+  // compressed; mu-law ones do not gain anything from it.
   for (int32_t i = 0; i < num_channels_; ++i) {
     block->tag = FourCC<'b', 'u', 'f', 'f'>::value;
     block->data = buffer_[i];
-    block->size = buffer_size_[num_channels_ - 1];
+    block->size = MemoryPlan(
+        buffer_size_[0], buffer_size_[1], num_channels_).sample_size();
+    block->compressed = resolution() == 16;
     ++block;
   }
   *num_blocks = block - first_block;
@@ -323,17 +590,27 @@ bool GranularProcessor::LoadPersistentData(const uint32_t* data) {
   GetPersistentData(block, &num_blocks);
   
   for (size_t i = 0; i < num_blocks; ++i) {
-    // Check that the format is correct.
-    if (block[i].tag != data[0] || block[i].size != data[1]) {
+    // Check that the format is correct, and load the data. 2 words are used
+    // for the block tag and the block size.
+    const uint32_t* payload = data + 2;
+    size_t num_words = data[1] / sizeof(uint32_t);
+    if (block[i].compressed && data[0] == kCompressedBlockTag) {
+      SampleDecoder decoder;
+      if (decoder.Decode(
+              payload,
+              num_words,
+              static_cast<int16_t*>(block[i].data),
+              block[i].size / sizeof(int16_t)) != num_words) {
+        silence_ = false;
+        return false;
+      }
+    } else if (block[i].tag == data[0] && block[i].size == data[1]) {
+      memcpy(block[i].data, payload, block[i].size);
+    } else {
       silence_ = false;
       return false;
     }
-    
-    // All good. Load the data. 2 words have already been used for the block tag
-    // and the block size.
-    data += 2;
-    memcpy(block[i].data, data, block[i].size);
-    data += block[i].size / sizeof(uint32_t);
+    data = payload + num_words;
     
     if (i == 0) {
       // We now know from which mode the data was saved.
@@ -367,92 +644,170 @@ bool GranularProcessor::LoadPersistentData(const uint32_t* data) {
   return true;
 }
 
-void GranularProcessor::Prepare() {
+bool GranularProcessor::PrepareBuffers() {
   bool playback_mode_changed = previous_playback_mode_ != playback_mode_;
-  bool benign_change = previous_playback_mode_ != PLAYBACK_MODE_SPECTRAL
-      && playback_mode_ != PLAYBACK_MODE_SPECTRAL
-      && previous_playback_mode_ != PLAYBACK_MODE_LAST;
+  bool benign_change = !playback_mode_change_reallocates();
   
-  if (!reset_buffers_ && playback_mode_changed && benign_change) {
+  // A change of mode is crossfaded by Process(), or waits for the previous
+  // mode to fade out, unless it is not heard anyway.
+  if (playback_mode_changed && !reset_buffers_ && !reallocating() &&
+      previous_playback_mode_ != PLAYBACK_MODE_LAST &&
+      (benign_change || mode_fade_ != 0.0f) && !silence_ && !bypass_) {
+    return false;
+  }
+  if (playback_mode_changed &&
+      previous_playback_mode_ != PLAYBACK_MODE_LAST) {
+    mode_fade_ = 0.0f;
+  }
+  
+  if (!reset_buffers_ && !reallocating() && playback_mode_changed &&
+      benign_change) {
     ResetFilters();
     pitch_shifter_.Clear();
     previous_playback_mode_ = playback_mode_;
+    next_playback_mode_ = playback_mode_;
   }
   
-  if ((playback_mode_changed && !benign_change) || reset_buffers_) {
-    parameters_.freeze = false;
+  if (reset_buffers_ || (playback_mode_changed && !benign_change) ||
+      reallocating()) {
+    // A change of mode or quality in the middle of a reallocation restarts
+    // it.
+    if (!reallocating() ||
+        reallocation_mode_ != playback_mode_ ||
+        reallocation_quality_ != quality()) {
+      parameters_.freeze = false;
+      reallocation_step_ = REALLOCATION_EFFECTS;
+      reallocation_mode_ = playback_mode_;
+      reallocation_quality_ = quality();
+      reallocation_cleared_ = 0;
+    }
+    return true;
   }
+  return false;
+}
+
+size_t GranularProcessor::ReallocationCost(ReallocationStep step) const {
+  // Clearing memory is assumed to take one cycle per 32-bit word.
+  switch (step) {
+    case REALLOCATION_EFFECTS:
+      return (FxWorkspace::size - FxWorkspace::reverb_size) / 4;
+    case REALLOCATION_REVERB:
+      return FxWorkspace::reverb_size / 4;
+    case REALLOCATION_CLEAR:
+      return kReallocationSliceSize / 4;
+    case REALLOCATION_BUFFERS:
+      return 1024;
+    default:
+      return 0;
+  }
+}
+
+size_t GranularProcessor::ReallocateStep() {
+  MemoryPlan plan(buffer_size_[0], buffer_size_[1], num_channels_);
+  void* buffer[2];
+  size_t buffer_size[2];
+  for (int32_t i = 0; i < 2; ++i) {
+    buffer[i] = i < num_channels_ ? buffer_[i] : NULL;
+    buffer_size[i] = i < num_channels_ ? plan.sample_size() : 0;
+  }
+  uint8_t* workspace = static_cast<uint8_t*>(
+      buffer_[plan.workspace_buffer()]) + plan.workspace_offset();
   
-  if (reset_buffers_ || (playback_mode_changed && !benign_change)) {
-    void* buffer[2];
-    size_t buffer_size[2];
-    void* workspace;
-    size_t workspace_size;
-    if (num_channels_ == 1) {
-      // Large buffer: 120k of sample memory.
-      // small buffer: fully allocated to FX workspace.
-      buffer[0] = buffer_[0];
-      buffer_size[0] = buffer_size_[0];
-      buffer[1] = NULL;
-      buffer_size[1] = 0;
-      workspace = buffer_[1];
-      workspace_size = buffer_size_[1];
-    } else {
-      // Large buffer: 64k of sample memory + FX workspace.
-      // small buffer: 64k of sample memory.
-      buffer_size[0] = buffer_size[1] = buffer_size_[1];
-      buffer[0] = buffer_[0];
-      buffer[1] = buffer_[1];
+  ReallocationStep step = reallocation_step_;
+  switch (step) {
+    case REALLOCATION_EFFECTS:
+      {
+        diffuser_.Init(reinterpret_cast<float*>(
+            workspace + FxWorkspace::diffuser_offset));
+        // The correlator and the pitch shifter share their memory.
+        uint32_t* correlator_data = reinterpret_cast<uint32_t*>(
+            workspace + FxWorkspace::shared_offset);
+        correlator_.Init(
+            &correlator_data[0],
+            &correlator_data[FxWorkspace::correlator_block_size]);
+        pitch_shifter_.Init(
+            reinterpret_cast<uint16_t*>(correlator_data),
+            sample_rate_);
+        reallocation_step_ = REALLOCATION_REVERB;
+      }
+      break;
       
-      workspace_size = buffer_size_[0] - buffer_size_[1];
-      workspace = static_cast<uint8_t*>(buffer[0]) + buffer_size[0];
-    }
-    float sr = sample_rate();
-
-    BufferAllocator allocator(workspace, workspace_size);
-    diffuser_.Init(allocator.Allocate<float>(2048));
-    reverb_.Init(allocator.Allocate<uint16_t>(16384));
-    
-    size_t correlator_block_size = (kMaxWSOLASize / 32) + 2;
-    uint32_t* correlator_data = allocator.Allocate<uint32_t>(
-        correlator_block_size * 3);
-    correlator_.Init(
-        &correlator_data[0],
-        &correlator_data[correlator_block_size]);
-    pitch_shifter_.Init((uint16_t*)correlator_data);
-    
-    if (playback_mode_ == PLAYBACK_MODE_SPECTRAL) {
-      phase_vocoder_.Init(
-          buffer, buffer_size,
-          lut_sine_window_4096, 4096,
-          num_channels_, resolution(), sr);
-    } else {
-      for (int32_t i = 0; i < num_channels_; ++i) {
-        if (resolution() == 8) {
-          buffer_8_[i].Init(
-              buffer[i],
-              (buffer_size[i]),
-              tail_buffer_[i]);
-        } else {
-          buffer_16_[i].Init(
-              buffer[i],
-              ((buffer_size[i]) >> 1),
-              tail_buffer_[i]);
+    case REALLOCATION_REVERB:
+      reverb_.Init(
+          reinterpret_cast<uint16_t*>(workspace + FxWorkspace::reverb_offset),
+          sample_rate_);
+      dirty_coefficients_ |= COEFFICIENTS_REVERB | COEFFICIENTS_PITCH_SHIFTER;
+      reallocation_step_ = REALLOCATION_CLEAR;
+      break;
+      
+    case REALLOCATION_CLEAR:
+      {
+        // Fills the sample memory of the channels with silence, one slice at
+        // a time. The phase vocoder and the recording buffers do not clear
+        // it themselves.
+        uint8_t silence = playback_mode_ != PLAYBACK_MODE_SPECTRAL &&
+            resolution() == 8
+                ? AudioBuffer<RESOLUTION_8_BIT_MU_LAW>::silence()
+                : AudioBuffer<RESOLUTION_16_BIT>::silence();
+        size_t channel = reallocation_cleared_ / plan.sample_size();
+        size_t offset = reallocation_cleared_ % plan.sample_size();
+        size_t size = min(kReallocationSliceSize, plan.sample_size() - offset);
+        uint8_t* samples = static_cast<uint8_t*>(buffer[channel]) + offset;
+        fill(&samples[0], &samples[size], silence);
+        reallocation_cleared_ += size;
+        if (reallocation_cleared_ == num_channels_ * plan.sample_size()) {
+          reallocation_step_ = REALLOCATION_BUFFERS;
+        }
+      }
+      break;
+      
+    case REALLOCATION_BUFFERS:
+      if (playback_mode_ == PLAYBACK_MODE_SPECTRAL) {
+        phase_vocoder_.Init(
+            buffer, buffer_size,
+            lut_sine_window_4096, kPhaseVocoderFftSize,
+            num_channels_, resolution(), sample_rate());
+      } else {
+        for (int32_t i = 0; i < num_channels_; ++i) {
+          if (resolution() == 8) {
+            buffer_8_[i].Init(
+                buffer[i],
+                (buffer_size[i]),
+                tail_buffer_[i]);
+          } else {
+            buffer_16_[i].Init(
+                buffer[i],
+                ((buffer_size[i]) >> 1),
+                tail_buffer_[i]);
+          }
         }
+        int32_t num_grains = (num_channels_ == 1 ? 40 : 32) * \
+            (low_fidelity_ ? 23 : 16) >> 4;
+        player_.Init(num_channels_, num_grains, sample_rate_);
+        ws_player_.Init(&correlator_, num_channels_);
+        looper_.Init(num_channels_);
       }
-      int32_t num_grains = (num_channels_ == 1 ? 40 : 32) * \
-          (low_fidelity_ ? 23 : 16) >> 4;
-      player_.Init(num_channels_, num_grains);
-      ws_player_.Init(&correlator_, num_channels_);
-      looper_.Init(num_channels_);
+      reset_buffers_ = false;
+      previous_playback_mode_ = playback_mode_;
+      next_playback_mode_ = playback_mode_;
+      reallocation_step_ = REALLOCATION_NONE;
+      break;
+      
+    default:
+      break;
+  }
+  return ReallocationCost(step);
+}
+
+void GranularProcessor::Prepare() {
+  if (PrepareBuffers()) {
+    while (reallocating()) {
+      ReallocateStep();
     }
-    reset_buffers_ = false;
-    previous_playback_mode_ = playback_mode_;
   }
-  
-  if (playback_mode_ == PLAYBACK_MODE_SPECTRAL) {
+  if (previous_playback_mode_ == PLAYBACK_MODE_SPECTRAL) {
     phase_vocoder_.Buffer();
-  } else if (playback_mode_ == PLAYBACK_MODE_STRETCH) {
+  } else if (correlating()) {
     if (resolution() == 8) {
       ws_player_.LoadCorrelator(buffer_8_);
     } else {
@@ -462,4 +817,57 @@ void GranularProcessor::Prepare() {
   }
 }
 
+void GranularProcessor::Prepare(size_t budget) {
+  size_t spent = 0;
+  if (PrepareBuffers()) {
+    while (reallocating() && spent < budget) {
+      spent += ReallocateStep();
+    }
+  }
+  while (spent < budget) {
+    size_t cost = 0;
+    if (previous_playback_mode_ == PLAYBACK_MODE_SPECTRAL) {
+      cost = phase_vocoder_.BufferStep();
+    } else if (correlating()) {
+      cost = resolution() == 8
+          ? ws_player_.LoadCorrelator(buffer_8_)
+          : ws_player_.LoadCorrelator(buffer_16_);
+      if (!cost) {
+        cost = correlator_.EvaluateCandidates(budget - spent);
+      }
+    }
+    if (!cost) {
+      break;
+    }
+    spent += cost;
+  }
+}
+
+size_t GranularProcessor::prepare_backlog() const {
+  if (reallocating() || reset_buffers_ || playback_mode_change_staged()) {
+    // Cost of the steps left, assuming the reallocation is not restarted.
+    MemoryPlan plan(buffer_size_[0], buffer_size_[1], num_channels_);
+    size_t left = num_channels_ * plan.sample_size();
+    int32_t step = REALLOCATION_EFFECTS;
+    if (reallocating()) {
+      left -= reallocation_cleared_;
+      step = reallocation_step_;
+    }
+    size_t num_slices = (left + kReallocationSliceSize - 1) / \
+        kReallocationSliceSize;
+    size_t backlog = num_slices * ReallocationCost(REALLOCATION_CLEAR);
+    for (; step <= REALLOCATION_BUFFERS; ++step) {
+      if (step != REALLOCATION_CLEAR) {
+        backlog += ReallocationCost(static_cast<ReallocationStep>(step));
+      }
+    }
+    return backlog;
+  } else if (previous_playback_mode_ == PLAYBACK_MODE_SPECTRAL) {
+    return phase_vocoder_.backlog();
+  } else if (correlating()) {
+    return correlator_.backlog();
+  }
+  return 0;
+}
+
 }  // namespace clouds
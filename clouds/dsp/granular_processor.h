@@ -40,7 +40,10 @@
 #include "clouds/dsp/granular_processor.h"
 #include "clouds/dsp/granular_sample_player.h"
 #include "clouds/dsp/looping_sample_player.h"
+#include "clouds/dsp/memory_plan.h"
+#include "clouds/dsp/parameter_channel.h"
 #include "clouds/dsp/pvoc/phase_vocoder.h"
+#include "clouds/dsp/sample_codec.h"
 #include "clouds/dsp/sample_rate_converter.h"
 #include "clouds/dsp/wsola_sample_player.h"
 
@@ -48,6 +51,10 @@ namespace clouds {
 
 const int32_t kDownsamplingFactor = 2;
 
+// Duration of the crossfade between two modes sharing the same buffers, and
+// of the fade out and fade in around a change to or from the spectral mode.
+const float kPlaybackModeFadeTime = 0.02f;
+
 enum PlaybackMode {
   PLAYBACK_MODE_GRANULAR,
   PLAYBACK_MODE_STRETCH,
@@ -56,6 +63,39 @@ enum PlaybackMode {
   PLAYBACK_MODE_LAST
 };
 
+// Regions of the memory plan used by each playback mode.
+inline constexpr uint32_t MemoryRegions(PlaybackMode mode) {
+  return mode == PLAYBACK_MODE_SPECTRAL
+      ? MEMORY_PLAN_PHASE_VOCODER | MEMORY_PLAN_REVERB
+      : MEMORY_PLAN_SAMPLES | MEMORY_PLAN_DIFFUSER | MEMORY_PLAN_REVERB |
+        (mode == PLAYBACK_MODE_STRETCH ? MEMORY_PLAN_CORRELATOR : 0) |
+        (mode == PLAYBACK_MODE_LOOPING_DELAY ? MEMORY_PLAN_PITCH_SHIFTER : 0);
+}
+
+// Sets of coefficients derived from the parameters, which are recomputed
+// only when a parameter they depend on changes, or when they are flagged as
+// dirty because the filter or effect using them has been reset.
+enum Coefficients {
+  COEFFICIENTS_FEEDBACK_FILTER = 1,
+  COEFFICIENTS_FILTERS = 2,
+  COEFFICIENTS_REVERB = 4,
+  COEFFICIENTS_PITCH_SHIFTER = 8,
+  COEFFICIENTS_ALL = 15
+};
+
+// Steps of a reallocation of the buffers, run one at a time by
+// Prepare(budget). The sample memory is cleared in slices of
+// kReallocationSliceSize bytes.
+enum ReallocationStep {
+  REALLOCATION_NONE,
+  REALLOCATION_EFFECTS,
+  REALLOCATION_REVERB,
+  REALLOCATION_CLEAR,
+  REALLOCATION_BUFFERS
+};
+
+const size_t kReallocationSliceSize = 4096;
+
 // State of the recording buffer as saved in one of the 4 sample memories.
 struct PersistentState {
   int32_t write_head[2];
@@ -63,27 +103,108 @@ struct PersistentState {
   uint8_t spectral;
 };
 
-// Data block as saved in one of the 4 sample memories.
+// Data block as saved in one of the 4 sample memories. A compressed block
+// holds 16-bit samples; it is saved with the SampleEncoder and the tag
+// kCompressedBlockTag, unless this does not make it smaller.
 struct PersistentBlock {
   uint32_t tag;
   uint32_t size;
   void* data;
+  bool compressed;
 };
 
+const uint32_t kCompressedBlockTag = stmlib::FourCC<'b', 'u', 'f', 'z'>::value;
+
+// Writes the blocks, each preceded by its tag and its size in bytes, to a
+// sink with a Write(uint32_t word) method.
+template<typename Sink>
+void WritePersistentBlocks(
+    const PersistentBlock* blocks,
+    size_t num_blocks,
+    Sink* sink) {
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const PersistentBlock& block = blocks[i];
+    if (block.compressed) {
+      const int16_t* samples = static_cast<const int16_t*>(block.data);
+      size_t num_samples = block.size / sizeof(int16_t);
+      size_t size = SampleEncoder::EncodedSize(samples, num_samples);
+      if (size < block.size) {
+        sink->Write(kCompressedBlockTag);
+        sink->Write(size);
+        SampleEncoder encoder;
+        uint32_t chunk[kSampleCodecMaxChunkWords];
+        encoder.Init(samples, num_samples);
+        while (!encoder.done()) {
+          size_t num_words = encoder.Encode(chunk);
+          for (size_t j = 0; j < num_words; ++j) {
+            sink->Write(chunk[j]);
+          }
+        }
+        continue;
+      }
+    }
+    sink->Write(block.tag);
+    sink->Write(block.size);
+    const uint32_t* words = static_cast<const uint32_t*>(block.data);
+    for (size_t j = 0; j < block.size / sizeof(uint32_t); ++j) {
+      sink->Write(words[j]);
+    }
+  }
+}
+
 class GranularProcessor {
  public:
   GranularProcessor() { }
   ~GranularProcessor() { }
   
+  // The processor runs at the given sample rate. Grain sizes, filter cutoffs,
+  // LFO frequencies, the reverb decay and the parameter smoothing times are
+  // rescaled from their values at kNativeSampleRate. Delay lengths in samples
+  // are not: the reverb, diffuser, pitch shifter and WSOLA windows get shorter
+  // at higher rates.
   void Init(
       void* large_buffer,
       size_t large_buffer_size,
       void* small_buffer,
-      size_t small_buffer_size);
+      size_t small_buffer_size,
+      float sample_rate);
 
+  // Any size can be processed; it is split into blocks of kMaxBlockSize
+  // frames. In low fidelity mode, the size must be a multiple of
+  // kDownsamplingFactor. Prepare() is not called between the blocks.
   void Process(ShortFrame* input, ShortFrame* output, size_t size);
+  
+  // Same, with interleaved stereo samples in [-1, 1]. The output has the
+  // same level as the 16-bit output, scaled to [-1, 1].
+  void Process(const float* input, float* output, size_t size);
+  
+  // Reallocates the buffers after a change of mode or quality, then does the
+  // deferred work of the current mode: the FFTs of the spectral mode, or the
+  // search of the next splice point of the stretch mode.
   void Prepare();
   
+  // Same, with the reallocation and the deferred work split into steps, which
+  // are run until about budget Cortex-M7 cycles have been spent. One step can
+  // overshoot the budget. Until a reallocation completes, only the dry signal
+  // is heard - or nothing, after a change of quality.
+  void Prepare(size_t budget);
+  
+  // Estimated cycles of reallocation and deferred work not done yet.
+  size_t prepare_backlog() const;
+  
+  // For hosts without an idle loop to call Prepare() from: when the budget is
+  // not 0, each call to Process() ends with Prepare(budget).
+  inline void set_prepare_budget(size_t budget) {
+    prepare_budget_ = budget;
+  }
+  
+  // When a channel is attached, each call to Process() starts by acquiring
+  // the latest snapshot published to it, if any. The writer then owns all
+  // the parameters, freeze included.
+  inline void set_parameter_channel(ParameterChannel<Parameters>* channel) {
+    parameter_channel_ = channel;
+  }
+  
   inline Parameters* mutable_parameters() {
     return &parameters_;
   }
@@ -116,12 +237,23 @@ class GranularProcessor {
     return bypass_;
   }
   
+  // The granular, stretch and looping delay modes share the same buffers:
+  // both players run during an equal-power crossfade from the current mode
+  // to the new one. A change to or from the spectral mode requires the
+  // buffers to be reallocated: the wet signal of the current mode fades out,
+  // Prepare() reallocates the buffers, then the wet signal of the new mode
+  // fades in. The dry signal is never interrupted.
   inline void set_playback_mode(PlaybackMode playback_mode) {
     playback_mode_ = playback_mode;
   }
   
   inline PlaybackMode playback_mode() const { return playback_mode_; }
   
+  // True while Prepare() is reallocating the buffers.
+  inline bool reallocating() const {
+    return reallocation_step_ != REALLOCATION_NONE;
+  }
+  
   inline void set_quality(int32_t quality) {
     set_num_channels(quality & 1 ? 1 : 2);
     set_low_fidelity(quality >> 1 ? true : false);
@@ -154,23 +286,104 @@ class GranularProcessor {
   }
 
   inline float sample_rate() const {
-    return 32000.0f / \
+    return sample_rate_ / \
         (low_fidelity_ ? kDownsamplingFactor : 1);
   }
+
+  // Changes to and from the spectral mode require the buffers to be
+  // reallocated; the other modes share the same buffers.
+  inline bool playback_mode_change_reallocates() const {
+    return previous_playback_mode_ == PLAYBACK_MODE_SPECTRAL ||
+        playback_mode_ == PLAYBACK_MODE_SPECTRAL ||
+        previous_playback_mode_ == PLAYBACK_MODE_LAST;
+  }
+  
+  // A change of mode waiting for the wet signal to fade out.
+  inline bool playback_mode_change_staged() const {
+    return previous_playback_mode_ != playback_mode_ &&
+        playback_mode_change_reallocates();
+  }
+  
+  inline bool crossfading() const {
+    return next_playback_mode_ != previous_playback_mode_;
+  }
+  
+  // Share of the signal coming from the previous and next modes at a given
+  // position of the crossfade, counting only the modes which use an effect.
+  static inline float Share(bool previous_uses, bool next_uses, float t) {
+    return (previous_uses ? 1.0f - t : 0.0f) + (next_uses ? t : 0.0f);
+  }
+  
+  // The stretch mode searches splice points with the correlator, whose memory
+  // is shared with the pitch shifter of the looping delay mode.
+  inline bool correlating() const {
+    return (previous_playback_mode_ == PLAYBACK_MODE_STRETCH ||
+            next_playback_mode_ == PLAYBACK_MODE_STRETCH) &&
+        previous_playback_mode_ != PLAYBACK_MODE_LOOPING_DELAY &&
+        next_playback_mode_ != PLAYBACK_MODE_LOOPING_DELAY;
+  }
+  
+  static inline bool filtered(PlaybackMode mode) {
+    return mode == PLAYBACK_MODE_LOOPING_DELAY ||
+        mode == PLAYBACK_MODE_STRETCH;
+  }
      
   void ResetFilters();
-  void ProcessGranular(FloatFrame* input, FloatFrame* output, size_t size);
+  bool PrepareBuffers();
+  size_t ReallocateStep();
+  size_t ReallocationCost(ReallocationStep step) const;
+  void StartCrossfade();
+  void ProcessBlock(const float* input, float* output, size_t size);
+  void MixOutput(const float* input, float* output, size_t size);
+  void MixWet(float start, float end, size_t size);
+  float Diffusion(PlaybackMode mode) const;
+  void ProcessGranular(
+      FloatFrame* input,
+      FloatFrame* output,
+      size_t size,
+      float crossfade_start,
+      float crossfade_end);
+  void Play(
+      PlaybackMode mode,
+      FloatFrame* input,
+      FloatFrame* output,
+      size_t size);
 
   PlaybackMode playback_mode_;
+  // Mode for which the buffers are set up, and which is heard. It differs
+  // from playback_mode_ while a change of mode is pending.
   PlaybackMode previous_playback_mode_;
+  // Mode faded in while crossfading, previous_playback_mode_ otherwise.
+  PlaybackMode next_playback_mode_;
   int32_t num_channels_;
   bool low_fidelity_;
+  float sample_rate_;
+  size_t prepare_budget_;
   
   bool silence_;
   bool bypass_;
   bool reset_buffers_;
+  // Mode and quality the buffers are being reallocated for, and bytes of
+  // sample memory cleared so far.
+  ReallocationStep reallocation_step_;
+  PlaybackMode reallocation_mode_;
+  int32_t reallocation_quality_;
+  size_t reallocation_cleared_;
   float freeze_lp_;
+  float freeze_coefficient_;
   float dry_wet_;
+  float mode_fade_;
+  float mode_fade_increment_;
+  float mode_crossfade_;
+  
+  // Dirty coefficients, and parameter values the others were computed from.
+  uint8_t dirty_coefficients_;
+  float feedback_filter_feedback_;
+  float filters_texture_;
+  float filters_feedback_;
+  float reverb_amount_;
+  float reverb_feedback_;
+  float pitch_shifter_pitch_;
   
   void* buffer_[2];
   size_t buffer_size_[2];
@@ -197,10 +410,14 @@ class GranularProcessor {
   FloatFrame out_downsampled_[kMaxBlockSize / kDownsamplingFactor];
   FloatFrame out_[kMaxBlockSize];
   FloatFrame fb_[kMaxBlockSize];
+  // Output of the next mode's player, then wet signal of an effect, while
+  // crossfading.
+  FloatFrame crossfade_[kMaxBlockSize];
   
   int16_t tail_buffer_[2][256];
   
   Parameters parameters_;
+  ParameterChannel<Parameters>* parameter_channel_;
   
   SampleRateConverter<-kDownsamplingFactor, 45, src_filter_1x_2_45> src_down_;
   SampleRateConverter<+kDownsamplingFactor, 45, src_filter_1x_2_45> src_up_;
@@ -55,14 +55,19 @@ class GranularSamplePlayer {
   GranularSamplePlayer() { }
   ~GranularSamplePlayer() { }
   
-  void Init(int32_t num_channels, int32_t max_num_grains) {
+  // The grain sizes are scaled so that grains keep their duration at other
+  // sample rates.
+  void Init(int32_t num_channels, int32_t max_num_grains, float sample_rate) {
     max_num_grains_ = max_num_grains;
+    grain_size_scale_ = sample_rate / kNativeSampleRate;
     num_midfi_grains_ = 3 * max_num_grains / 4;
     gain_normalization_ = 1.0f;
     for (int32_t i = 0; i < kMaxNumGrains; ++i) {
       grains_[i].Init();
     }
     num_grains_ = 0.0f;
+    num_grains_rise_ = BlockCoefficient(0.9f, sample_rate);
+    num_grains_fall_ = BlockCoefficient(0.2f, sample_rate);
     num_channels_ = num_channels;
     grain_size_hint_ = 1024.0f;
   }
@@ -145,7 +150,11 @@ class GranularSamplePlayer {
     
     // Compute normalization factor.
     int32_t active_grains = max_num_grains_ - num_available_grains;
-    SLOPE(num_grains_, static_cast<float>(active_grains), 0.9f, 0.2f);
+    SLOPE(
+        num_grains_,
+        static_cast<float>(active_grains),
+        num_grains_rise_,
+        num_grains_fall_);
 
     float gain_normalization = num_grains_ > 2.0f
         ? fast_rsqrt_carmack(num_grains_ - 1.0f)
@@ -186,6 +195,7 @@ class GranularSamplePlayer {
     float pitch = parameters.pitch;
     float window_shape = parameters.granular.window_shape;
     float grain_size = Interpolate(lut_grain_size, parameters.size, 256.0f);
+    grain_size *= grain_size_scale_;
     float pitch_ratio = SemitonesToRatio(pitch);
     float inv_pitch_ratio = SemitonesToRatio(-pitch);
     float pan = 0.5f + parameters.stereo_spread * (Random::GetFloat() - 0.5f);
@@ -240,8 +250,11 @@ class GranularSamplePlayer {
   int32_t num_channels_;
 
   float num_grains_;
+  float num_grains_rise_;
+  float num_grains_fall_;
   float gain_normalization_;
   float grain_size_hint_;
+  float grain_size_scale_;
   float grain_rate_phasor_;
   
   Grain grains_[kMaxNumGrains];
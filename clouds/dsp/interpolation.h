@@ -0,0 +1,48 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Interpolation kernels for fractional reads, shared by the sample buffers
+// and the FX engine.
+
+#ifndef CLOUDS_DSP_INTERPOLATION_H_
+#define CLOUDS_DSP_INTERPOLATION_H_
+
+namespace clouds {
+
+// ALLPASS is only implemented by FxEngine: it is the first-order allpass
+// interpolator described by Dattorro, with a flat magnitude response, but it
+// requires a state variable per tap, and rings when the fractional part of the
+// delay gets close to 0.
+enum InterpolationMethod {
+  INTERPOLATION_ZOH,
+  INTERPOLATION_LINEAR,
+  INTERPOLATION_HERMITE,
+  INTERPOLATION_ALLPASS
+};
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_INTERPOLATION_H_
@@ -0,0 +1,200 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Layout of the memory of the granular processor. The processor is given a
+// large and a small buffer, holding the sample memory of each channel, the
+// FX workspace and the buffers of the phase vocoder. The layout only depends
+// on the sizes of the two buffers and on the number of channels: all playback
+// modes share it, each one using a subset of the regions, so that switching
+// between modes which do not need a reallocation keeps the recording.
+//
+// The plan is evaluated at compile time for the memory of the module, and at
+// run time for the buffers actually given to the processor.
+
+#ifndef CLOUDS_DSP_MEMORY_PLAN_H_
+#define CLOUDS_DSP_MEMORY_PLAN_H_
+
+#include "stmlib/stmlib.h"
+
+#include "clouds/dsp/fx/diffuser.h"
+#include "clouds/dsp/fx/pitch_shifter.h"
+#include "clouds/dsp/fx/reverb.h"
+#include "clouds/dsp/pvoc/frame_transformation.h"
+#include "clouds/dsp/wsola_sample_player.h"
+
+namespace clouds {
+
+// Sizes of block_mem and block_ccm on the module.
+const size_t kLargeBufferSize = 118784;
+const size_t kSmallBufferSize = 65536 - 128;
+
+const size_t kPhaseVocoderFftSize = 4096;
+
+// Regions of the memory used by a playback mode.
+enum MemoryPlanRegion {
+  MEMORY_PLAN_SAMPLES = 1,
+  MEMORY_PLAN_DIFFUSER = 2,
+  MEMORY_PLAN_REVERB = 4,
+  MEMORY_PLAN_CORRELATOR = 8,
+  MEMORY_PLAN_PITCH_SHIFTER = 16,
+  MEMORY_PLAN_PHASE_VOCODER = 32
+};
+
+// The correlator is only used in the stretch mode, and the pitch shifter in
+// the looping mode: they share the end of the workspace.
+struct FxWorkspace {
+  enum {
+    diffuser_offset = 0,
+    diffuser_size = Diffuser::buffer_size * sizeof(float),
+    reverb_offset = diffuser_offset + diffuser_size,
+    reverb_size = Reverb::buffer_size * sizeof(uint16_t),
+    shared_offset = reverb_offset + reverb_size,
+    correlator_block_size = kMaxWSOLASize / 32 + 2,
+    correlator_size = correlator_block_size * 3 * sizeof(uint32_t),
+    pitch_shifter_size = PitchShifter::buffer_size * sizeof(uint16_t),
+    shared_size = correlator_size > pitch_shifter_size
+        ? correlator_size
+        : pitch_shifter_size,
+    size = shared_offset + shared_size
+  };
+};
+
+STATIC_ASSERT(FxWorkspace::reverb_offset % 4 == 0, unaligned_reverb);
+STATIC_ASSERT(FxWorkspace::shared_offset % 4 == 0, unaligned_correlator);
+
+// The phase vocoder takes the sample memory of each channel. Its FFT buffer is
+// in the first channel, its IFFT buffer in the last one, and the rest is
+// filled with textures, the same number for each channel.
+struct PhaseVocoderMemory {
+  enum {
+    fft_size = kPhaseVocoderFftSize * sizeof(float),
+    analysis_synthesis_size = \
+        (kPhaseVocoderFftSize + (kPhaseVocoderFftSize >> 1)) * 2 * \
+        sizeof(short),
+    texture_size = \
+        ((kPhaseVocoderFftSize >> 1) - kHighFrequencyTruncation) * \
+        sizeof(float)
+  };
+};
+
+class MemoryPlan {
+ public:
+  constexpr MemoryPlan(
+      size_t large_size,
+      size_t small_size,
+      int32_t num_channels)
+      : large_size_(large_size),
+        small_size_(small_size),
+        num_channels_(num_channels) { }
+  
+  // Size of the sample memory of each channel. In mono, it is the whole large
+  // buffer, and the workspace is in the small buffer. In stereo, both channels
+  // get the small buffer; and the first one, the same size at the start of the
+  // large buffer, followed by the workspace. The sample memory is then as long
+  // as it can be: the second channel does not fit anywhere else.
+  constexpr size_t sample_size() const {
+    return num_channels_ == 1
+        ? large_size_
+        : (large_size_ < FxWorkspace::size
+            ? 0
+            : (small_size_ < large_size_ - FxWorkspace::size
+                ? small_size_
+                : large_size_ - FxWorkspace::size));
+  }
+  
+  // Buffer (0: large, 1: small) and offset of the workspace.
+  constexpr int32_t workspace_buffer() const {
+    return num_channels_ == 1 ? 1 : 0;
+  }
+  
+  constexpr size_t workspace_offset() const {
+    return num_channels_ == 1 ? 0 : sample_size();
+  }
+  
+  constexpr bool fits() const {
+    return sample_size() != 0 && num_textures() != 0 && (num_channels_ == 1
+        ? FxWorkspace::size <= small_size_
+        : sample_size() <= small_size_ &&
+          sample_size() + FxWorkspace::size <= large_size_);
+  }
+  
+  // Number of textures of the phase vocoder, as allocated by its Init().
+  constexpr size_t num_textures() const {
+    return phase_vocoder_free() / PhaseVocoderMemory::texture_size < \
+        static_cast<size_t>(kMaxNumTextures)
+        ? phase_vocoder_free() / PhaseVocoderMemory::texture_size
+        : static_cast<size_t>(kMaxNumTextures);
+  }
+  
+  constexpr size_t size(uint32_t regions) const {
+    return (regions & MEMORY_PLAN_SAMPLES
+            ? num_channels_ * sample_size() : 0) +
+        (regions & MEMORY_PLAN_DIFFUSER ? FxWorkspace::diffuser_size : 0) +
+        (regions & MEMORY_PLAN_REVERB ? FxWorkspace::reverb_size : 0) +
+        (regions & MEMORY_PLAN_CORRELATOR
+            ? FxWorkspace::correlator_size : 0) +
+        (regions & MEMORY_PLAN_PITCH_SHIFTER
+            ? FxWorkspace::pitch_shifter_size : 0) +
+        (regions & MEMORY_PLAN_PHASE_VOCODER
+            ? num_channels_ * (PhaseVocoderMemory::analysis_synthesis_size +
+                num_textures() * PhaseVocoderMemory::texture_size) +
+              2 * PhaseVocoderMemory::fft_size
+            : 0);
+  }
+  
+  // Bytes of the two buffers not used by a mode.
+  constexpr size_t wasted_size(uint32_t regions) const {
+    return large_size_ + small_size_ - size(regions);
+  }
+  
+ private:
+  // Memory left for the textures in each channel.
+  constexpr size_t phase_vocoder_free() const {
+    return sample_size() < phase_vocoder_fixed_size()
+        ? 0
+        : sample_size() - phase_vocoder_fixed_size();
+  }
+  
+  constexpr size_t phase_vocoder_fixed_size() const {
+    return PhaseVocoderMemory::analysis_synthesis_size +
+        (num_channels_ == 1 ? 2 : 1) * PhaseVocoderMemory::fft_size;
+  }
+  
+  size_t large_size_;
+  size_t small_size_;
+  int32_t num_channels_;
+};
+
+STATIC_ASSERT(
+    MemoryPlan(kLargeBufferSize, kSmallBufferSize, 1).fits(),
+    mono_memory_plan_does_not_fit);
+STATIC_ASSERT(
+    MemoryPlan(kLargeBufferSize, kSmallBufferSize, 2).fits(),
+    stereo_memory_plan_does_not_fit);
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_MEMORY_PLAN_H_
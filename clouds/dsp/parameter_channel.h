@@ -0,0 +1,146 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Lock-free channel carrying snapshots of a parameter structure from one
+// writer to one reader, which can be an interrupt handler or another thread.
+// Snapshots are written alternately to two slots, each with a version counter
+// which is odd while the slot is being written. The reader copies the last
+// published slot and checks its version did not move; it only has to retry
+// when the writer has started overwriting that very slot, that is to say
+// after a whole other snapshot has been published during the copy. The writer
+// never waits.
+//
+// The counters are volatile. There is one hardware barrier on each side, a
+// DMB on the Cortex-M4: a release before the writer publishes the sequence
+// number, and an acquire after the reader loads it. The version checks of a
+// slot are otherwise ordered by compiler barriers, which is enough where the
+// reader sees the writer's accesses in program order: an interrupt handler on
+// the Cortex-M core, or a thread on x86. Elsewhere they are full barriers.
+// None of this needs the C++11 atomics of libstdc++.
+
+#ifndef CLOUDS_DSP_PARAMETER_CHANNEL_H_
+#define CLOUDS_DSP_PARAMETER_CHANNEL_H_
+
+#include "stmlib/stmlib.h"
+
+namespace clouds {
+
+template<typename T>
+class ParameterChannel {
+ public:
+  ParameterChannel() { }
+  ~ParameterChannel() { }
+  
+  void Init(const T& value) {
+    for (int32_t i = 0; i < 2; ++i) {
+      slot_[i].value = value;
+      slot_[i].version = 0;
+    }
+    sequence_ = 0;
+    acquired_ = 0;
+    ReleaseBarrier();
+  }
+  
+  // Writer side. To be called once per update of the whole structure.
+  inline void Publish(const T& value) {
+    uint32_t sequence = sequence_ + 1;
+    Slot* slot = &slot_[sequence & 1];
+    uint32_t version = slot->version;
+    slot->version = version + 1;
+    SlotBarrier();
+    slot->value = value;
+    SlotBarrier();
+    slot->version = version + 2;
+    ReleaseBarrier();
+    sequence_ = sequence;
+  }
+  
+  // Reader side. Copies the latest snapshot to value and returns true, or
+  // returns false and leaves value untouched if nothing has been published
+  // since the previous call.
+  inline bool Acquire(T* value) {
+    uint32_t sequence = sequence_;
+    if (sequence == acquired_) {
+      return false;
+    }
+    while (true) {
+      AcquireBarrier();
+      const Slot& slot = slot_[sequence & 1];
+      uint32_t version = slot.version;
+      if (!(version & 1)) {
+        SlotBarrier();
+        *value = slot.value;
+        SlotBarrier();
+        if (slot.version == version) {
+          break;
+        }
+      }
+      sequence = sequence_;
+    }
+    acquired_ = sequence;
+    return true;
+  }
+  
+  // Number of snapshots published since Init().
+  inline uint32_t sequence() const {
+    return sequence_;
+  }
+  
+ private:
+  struct Slot {
+    T value;
+    volatile uint32_t version;
+  };
+  
+  // The fences also keep the compiler from moving memory accesses across
+  // them. On x86, the release and acquire fences are compiler barriers only.
+  static inline void ReleaseBarrier() {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+  
+  static inline void AcquireBarrier() {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }
+  
+  static inline void SlotBarrier() {
+#if defined(__i386__) || defined(__x86_64__) || \
+    (defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M')
+    __asm__ __volatile__("" ::: "memory");
+#else
+    __sync_synchronize();
+#endif  // x86 or Cortex-M
+  }
+  
+  Slot slot_[2];
+  volatile uint32_t sequence_;
+  uint32_t acquired_;
+  
+  DISALLOW_COPY_AND_ASSIGN(ParameterChannel);
+};
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_PARAMETER_CHANNEL_H_
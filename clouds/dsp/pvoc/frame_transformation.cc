@@ -57,7 +57,6 @@ void FrameTransformation::Init(
   phases_delta_ = phases_ + size_;
 
   glitch_algorithm_ = 0;
-  Reset();
 }
 
 void FrameTransformation::Reset() {
@@ -47,6 +47,8 @@ class FrameTransformation {
   FrameTransformation() { }
   ~FrameTransformation() { }
   
+  // The textures are not cleared: they must already be filled with zeros.
+  // Reset() clears them.
   void Init(float* buffer, int32_t fft_size, int32_t num_textures);
   void Reset();
   
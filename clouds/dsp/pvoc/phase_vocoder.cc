@@ -46,6 +46,7 @@ void PhaseVocoder::Init(
     int32_t resolution,
     float sample_rate) {
   num_channels_ = num_channels;
+  channel_ = 0;
 
   size_t fft_size = largest_fft_size;
   size_t hop_ratio = 4;
@@ -99,9 +100,31 @@ void PhaseVocoder::Process(
 }
 
 void PhaseVocoder::Buffer() {
+  // Complete the frame left in progress by BufferStep() first.
   for (int32_t i = 0; i < num_channels_; ++i) {
-    stft_[i].Buffer();
+    stft_[(channel_ + i) % num_channels_].Buffer();
   }
 }
 
+size_t PhaseVocoder::BufferStep() {
+  for (int32_t i = 0; i < num_channels_; ++i) {
+    size_t cost = stft_[channel_].BufferStep();
+    if (!stft_[channel_].frame_in_progress()) {
+      channel_ = (channel_ + 1) % num_channels_;
+    }
+    if (cost) {
+      return cost;
+    }
+  }
+  return 0;
+}
+
+size_t PhaseVocoder::backlog() const {
+  size_t cost = 0;
+  for (int32_t i = 0; i < num_channels_; ++i) {
+    cost += stft_[i].backlog();
+  }
+  return cost;
+}
+
 }  // namespace clouds
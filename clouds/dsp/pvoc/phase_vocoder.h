@@ -46,6 +46,7 @@ class PhaseVocoder {
   PhaseVocoder() { }
   ~PhaseVocoder() { }
   
+  // The buffers must already be filled with zeros.
   void Init(
       void** buffer, size_t* buffer_size,
       const float* large_window_lut, size_t largest_fft_size,
@@ -60,6 +61,11 @@ class PhaseVocoder {
       size_t size);
   void Buffer();
   
+  // Runs one stage of the STFT of one channel. Returns an estimate of its
+  // cost in cycles, or 0 when there is nothing to do.
+  size_t BufferStep();
+  size_t backlog() const;
+  
  private:
   FFT fft_;
   
@@ -68,6 +74,11 @@ class PhaseVocoder {
 
   int32_t num_channels_;
   
+  // Channel whose frame BufferStep() is processing. The two STFTs share
+  // their FFT buffers, so a frame must go through all its stages before the
+  // other channel starts one.
+  int32_t channel_;
+  
   DISALLOW_COPY_AND_ASSIGN(PhaseVocoder);
 };
 
@@ -74,17 +74,22 @@ void STFT::Init(
   
   parameters_ = NULL;
   
-  Reset();
+  Rewind();
 }
 
 void STFT::Reset() {
+  fill(&analysis_[0], &analysis_[buffer_size_], 0);
+  fill(&synthesis_[0], &synthesis_[buffer_size_], 0);
+  Rewind();
+}
+
+void STFT::Rewind() {
   buffer_ptr_ = 0;
   process_ptr_ = (2 * hop_size_) % buffer_size_;
   block_size_ = 0;
-  fill(&analysis_[0], &analysis_[buffer_size_], 0);
-  fill(&synthesis_[0], &synthesis_[buffer_size_], 0);
   ready_ = 0;
   done_ = 0;
+  stage_ = STAGE_ANALYSIS;
 }
 
 void STFT::Process(
@@ -121,90 +126,148 @@ void STFT::Buffer() {
   if (ready_ == done_) {
     return;
   }
-  
-  // Copy block to FFT buffer and apply window.
-  size_t source_ptr = process_ptr_;
-  const float* w = window_;
-  for (size_t i = 0; i < fft_size_; ++i) {
-    fft_in_[i] = w[0] * analysis_[source_ptr];
-    ++source_ptr;
-    if (source_ptr >= buffer_size_) {
-      source_ptr -= buffer_size_;
-    }
-    w += window_stride_;
+  do {
+    BufferStep();
+  } while (stage_ != STAGE_ANALYSIS);
+}
+
+size_t STFT::StageCost(size_t stage) const {
+  // Rough figures, per sample of the frame.
+  switch (stage) {
+    case STAGE_FFT:
+    case STAGE_IFFT:
+      return fft_size_ * fft_num_passes_ * 3;
+    case STAGE_MODIFY:
+      return fft_size_ * 16;
+    default:
+      return fft_size_ * 6;
   }
-  
-  // Compute FFT. fft_in is lost.
-#ifdef USE_ARM_FFT
-  arm_rfft_fast_f32(fft_, fft_in_, fft_out_, 0);
-  copy(&fft_out_[0], &fft_out_[fft_size_], &fft_in_[0]);
-  // Re-arrange data.
-  for (size_t i = 0; i < fft_size_ / 2; ++i) {
-    fft_out_[i] = fft_in_[2 * i];
-    fft_out_[i + fft_size_ / 2] = fft_in_[2 * i + 1];
+}
+
+size_t STFT::backlog() const {
+  size_t frame_cost = 0;
+  for (size_t stage = STAGE_ANALYSIS; stage < STAGE_LAST; ++stage) {
+    frame_cost += StageCost(stage);
   }
-#else
-  if (fft_size_ != FFT::max_size) {
-    fft_->Direct(fft_in_, fft_out_, fft_num_passes_);
-  } else {
-    fft_->Direct(fft_in_, fft_out_);
+  size_t cost = (ready_ - done_) * frame_cost;
+  for (size_t stage = STAGE_ANALYSIS; stage < stage_; ++stage) {
+    cost -= StageCost(stage);
   }
-#endif  // USE_ARM_FFT
-  // Process in the frequency domain.
-  if (modifier_ != NULL && parameters_ != NULL) {
-    modifier_->Process(*parameters_, &fft_out_[0], &ifft_in_[0]);
-  } else {
-    copy(&fft_out_[0], &fft_out_[fft_size_], &ifft_in_[0]);
+  return cost;
+}
+
+size_t STFT::BufferStep() {
+  if (ready_ == done_) {
+    return 0;
   }
   
-  // Compute IFFT. ifft_in is lost.
+  size_t cost = StageCost(stage_);
+  switch (stage_) {
+    case STAGE_ANALYSIS:
+      {
+        // Copy block to FFT buffer and apply window.
+        size_t source_ptr = process_ptr_;
+        const float* w = window_;
+        for (size_t i = 0; i < fft_size_; ++i) {
+          fft_in_[i] = w[0] * analysis_[source_ptr];
+          ++source_ptr;
+          if (source_ptr >= buffer_size_) {
+            source_ptr -= buffer_size_;
+          }
+          w += window_stride_;
+        }
+      }
+      break;
+      
+    case STAGE_FFT:
+      // Compute FFT. fft_in is lost.
 #ifdef USE_ARM_FFT
-  // Re-arrange data.
-  copy(&ifft_in_[0], &ifft_in_[fft_size_], &ifft_out_[0]);
-  for (size_t i = 0; i < fft_size_ / 2; ++i) {
-    ifft_in_[2 * i] = ifft_out_[i];
-    ifft_in_[2 * i + 1] = ifft_out_[i + fft_size_ / 2];
-  }
-  arm_rfft_fast_f32(fft_, ifft_in_, ifft_out_, 1);
+      arm_rfft_fast_f32(fft_, fft_in_, fft_out_, 0);
+      copy(&fft_out_[0], &fft_out_[fft_size_], &fft_in_[0]);
+      // Re-arrange data.
+      for (size_t i = 0; i < fft_size_ / 2; ++i) {
+        fft_out_[i] = fft_in_[2 * i];
+        fft_out_[i + fft_size_ / 2] = fft_in_[2 * i + 1];
+      }
 #else
-  if (fft_size_ != FFT::max_size) {
-    fft_->Inverse(ifft_in_, ifft_out_, fft_num_passes_);
-  } else {
-    fft_->Inverse(ifft_in_, ifft_out_);
-  }
+      if (fft_size_ != FFT::max_size) {
+        fft_->Direct(fft_in_, fft_out_, fft_num_passes_);
+      } else {
+        fft_->Direct(fft_in_, fft_out_);
+      }
 #endif  // USE_ARM_FFT
-  
-  size_t destination_ptr = process_ptr_;
+      break;
+      
+    case STAGE_MODIFY:
+      // Process in the frequency domain.
+      if (modifier_ != NULL && parameters_ != NULL) {
+        modifier_->Process(*parameters_, &fft_out_[0], &ifft_in_[0]);
+      } else {
+        copy(&fft_out_[0], &fft_out_[fft_size_], &ifft_in_[0]);
+      }
+      break;
+      
+    case STAGE_IFFT:
+      // Compute IFFT. ifft_in is lost.
 #ifdef USE_ARM_FFT
-  float inverse_window_size = 1.0f / \
-      float(fft_size_ / hop_size_ >> 1);
+      // Re-arrange data.
+      copy(&ifft_in_[0], &ifft_in_[fft_size_], &ifft_out_[0]);
+      for (size_t i = 0; i < fft_size_ / 2; ++i) {
+        ifft_in_[2 * i] = ifft_out_[i];
+        ifft_in_[2 * i + 1] = ifft_out_[i + fft_size_ / 2];
+      }
+      arm_rfft_fast_f32(fft_, ifft_in_, ifft_out_, 1);
 #else
-  float inverse_window_size = 1.0f / \
-      float(fft_size_ * fft_size_ / hop_size_ >> 1);
+      if (fft_size_ != FFT::max_size) {
+        fft_->Inverse(ifft_in_, ifft_out_, fft_num_passes_);
+      } else {
+        fft_->Inverse(ifft_in_, ifft_out_);
+      }
 #endif  // USE_ARM_FFT
-    
-  w = window_;
-  for (size_t i = 0; i < fft_size_; ++i) {
-    float s = ifft_out_[i] * w[0] * inverse_window_size;
-    
-    int32_t x = static_cast<int32_t>(s);
-    if (i < fft_size_ - hop_size_) {
-      // Overlap-add.
-      x += synthesis_[destination_ptr];
-    }
-    synthesis_[destination_ptr] = Clip16(x);
-    ++destination_ptr;
-    if (destination_ptr >= buffer_size_) {
-      destination_ptr -= buffer_size_;
-    }
-    w += window_stride_;
+      break;
+      
+    case STAGE_SYNTHESIS:
+      {
+        size_t destination_ptr = process_ptr_;
+#ifdef USE_ARM_FFT
+        float inverse_window_size = 1.0f / \
+            float(fft_size_ / hop_size_ >> 1);
+#else
+        float inverse_window_size = 1.0f / \
+            float(fft_size_ * fft_size_ / hop_size_ >> 1);
+#endif  // USE_ARM_FFT
+        
+        const float* w = window_;
+        for (size_t i = 0; i < fft_size_; ++i) {
+          float s = ifft_out_[i] * w[0] * inverse_window_size;
+          
+          int32_t x = static_cast<int32_t>(s);
+          if (i < fft_size_ - hop_size_) {
+            // Overlap-add.
+            x += synthesis_[destination_ptr];
+          }
+          synthesis_[destination_ptr] = Clip16(x);
+          ++destination_ptr;
+          if (destination_ptr >= buffer_size_) {
+            destination_ptr -= buffer_size_;
+          }
+          w += window_stride_;
+        }
+        
+        ++done_;
+        process_ptr_ += hop_size_;
+        if (process_ptr_ >= buffer_size_) {
+          process_ptr_ -= buffer_size_;
+        }
+      }
+      break;
   }
-
-  ++done_;
-  process_ptr_ += hop_size_;
-  if (process_ptr_ >= buffer_size_) {
-    process_ptr_ -= buffer_size_;
+  
+  ++stage_;
+  if (stage_ == STAGE_LAST) {
+    stage_ = STAGE_ANALYSIS;
   }
+  return cost;
 }
 
 }  // namespace clouds
@@ -69,6 +69,8 @@ class STFT {
       short* stft_frame_processor_buffer,
       Modifier* modifier);
 
+  // Init() does not clear the analysis and synthesis buffers: they must
+  // already be filled with zeros. Reset() clears them.
   void Reset();
 
   void Process(
@@ -78,9 +80,34 @@ class STFT {
       size_t size,
       size_t stride);
 
+  // Processes the next pending frame, or completes the one in progress.
   void Buffer();
   
+  // Runs one stage of the processing of the next pending frame. Returns an
+  // estimate of its cost in Cortex-M7 cycles, or 0 when no frame is pending.
+  size_t BufferStep();
+  
+  // Estimated cost, in cycles, of the frames left to process.
+  size_t backlog() const;
+  
+  // True when a frame has gone through some, but not all, of its stages.
+  inline bool frame_in_progress() const {
+    return stage_ != STAGE_ANALYSIS;
+  }
+  
  private:
+  enum Stage {
+    STAGE_ANALYSIS,
+    STAGE_FFT,
+    STAGE_MODIFY,
+    STAGE_IFFT,
+    STAGE_SYNTHESIS,
+    STAGE_LAST
+  };
+  
+  void Rewind();
+  size_t StageCost(size_t stage) const;
+  
   FFT* fft_;
   size_t fft_size_;
   size_t fft_num_passes_;
@@ -103,6 +130,7 @@ class STFT {
   
   size_t ready_;
   size_t done_;
+  size_t stage_;
   
   const Parameters* parameters_;
   
@@ -0,0 +1,351 @@
+// Copyright 2014 Olivier Gillet.
+//
+// Author: Olivier Gillet (pichenettes@mutable-instruments.net)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Lossless codec for the 16-bit sample memory, as saved to flash. Samples are
+// coded in chunks of kSampleCodecChunkSize. Each chunk is predicted with a
+// fixed polynomial predictor of order 0, 1 or 2, and the residuals are Rice
+// coded; or, when this does not make it smaller, the chunk is stored verbatim.
+// A chunk does not depend on the previous ones, and is padded to a whole
+// number of words, so that it can be written to flash as soon as it has been
+// encoded.
+//
+// Chunk header: 2 bits of method, 4 bits of Rice parameter k. Each residual is
+// zigzag mapped to an unsigned value u; u >> k is written in unary (that many
+// ones, then a zero) followed by the k low bits of u. When u >> k reaches
+// kSampleCodecEscape, the escape code (kSampleCodecEscape ones) is followed by
+// u on kSampleCodecEscapeBits bits.
+
+#ifndef CLOUDS_DSP_SAMPLE_CODEC_H_
+#define CLOUDS_DSP_SAMPLE_CODEC_H_
+
+#include "stmlib/stmlib.h"
+
+namespace clouds {
+
+const size_t kSampleCodecChunkSize = 256;
+const int32_t kSampleCodecHeaderBits = 6;
+const int32_t kSampleCodecMaxRiceParameter = 15;
+const uint32_t kSampleCodecEscape = 16;
+const int32_t kSampleCodecEscapeBits = 18;
+
+// Largest encoded chunk, a verbatim one.
+const size_t kSampleCodecMaxChunkWords = \
+    (kSampleCodecHeaderBits + 16 * kSampleCodecChunkSize + 31) / 32;
+
+enum SampleCodecMethod {
+  SAMPLE_CODEC_ORDER_0,
+  SAMPLE_CODEC_ORDER_1,
+  SAMPLE_CODEC_ORDER_2,
+  SAMPLE_CODEC_VERBATIM
+};
+
+// The first samples of a chunk are predicted with the highest order their
+// history allows.
+inline int32_t SampleCodecResidual(
+    const int16_t* samples,
+    size_t i,
+    int32_t order) {
+  int32_t x = samples[i];
+  if (order == 0 || i == 0) {
+    return x;
+  } else if (order == 1 || i == 1) {
+    return x - samples[i - 1];
+  } else {
+    return x - 2 * samples[i - 1] + samples[i - 2];
+  }
+}
+
+inline uint32_t SampleCodecZigzag(int32_t x) {
+  return (static_cast<uint32_t>(x) << 1) ^ static_cast<uint32_t>(x >> 31);
+}
+
+inline int32_t SampleCodecUnzigzag(uint32_t u) {
+  return static_cast<int32_t>(u >> 1) ^ -static_cast<int32_t>(u & 1);
+}
+
+class SampleEncoder {
+ public:
+  SampleEncoder() { }
+  ~SampleEncoder() { }
+  
+  void Init(const int16_t* samples, size_t size) {
+    samples_ = samples;
+    size_ = size;
+    position_ = 0;
+  }
+  
+  inline bool done() const { return position_ >= size_; }
+  
+  // Encodes the next chunk, and returns its size in words (at most
+  // kSampleCodecMaxChunkWords).
+  size_t Encode(uint32_t* out) {
+    const int16_t* samples = &samples_[position_];
+    size_t size = size_ - position_;
+    if (size > kSampleCodecChunkSize) {
+      size = kSampleCodecChunkSize;
+    }
+    position_ += size;
+    
+    int32_t order;
+    int32_t k;
+    uint32_t bits = Analyze(samples, size, &order, &k);
+    
+    out_ = out;
+    word_ = 0;
+    num_bits_ = 0;
+    if (bits >= 16 * size) {
+      Write(SAMPLE_CODEC_VERBATIM << 4, kSampleCodecHeaderBits);
+      for (size_t i = 0; i < size; ++i) {
+        Write(static_cast<uint16_t>(samples[i]), 16);
+      }
+    } else {
+      Write((order << 4) | k, kSampleCodecHeaderBits);
+      for (size_t i = 0; i < size; ++i) {
+        uint32_t u = SampleCodecZigzag(SampleCodecResidual(samples, i, order));
+        uint32_t q = u >> k;
+        if (q < kSampleCodecEscape) {
+          uint32_t low = u & ((1 << k) - 1);
+          Write((((1 << q) - 1) << (k + 1)) | low, q + 1 + k);
+        } else {
+          Write((1 << kSampleCodecEscape) - 1, kSampleCodecEscape);
+          Write(u, kSampleCodecEscapeBits);
+        }
+      }
+    }
+    if (num_bits_) {
+      *out_++ = word_;
+    }
+    return out_ - out;
+  }
+  
+  // Size in bytes of the encoded samples, found without encoding them.
+  static size_t EncodedSize(const int16_t* samples, size_t size) {
+    size_t num_words = 0;
+    for (size_t i = 0; i < size; i += kSampleCodecChunkSize) {
+      size_t chunk_size = size - i;
+      if (chunk_size > kSampleCodecChunkSize) {
+        chunk_size = kSampleCodecChunkSize;
+      }
+      int32_t order;
+      int32_t k;
+      uint32_t bits = Analyze(&samples[i], chunk_size, &order, &k);
+      if (bits > 16 * chunk_size) {
+        bits = 16 * chunk_size;
+      }
+      num_words += (kSampleCodecHeaderBits + bits + 31) / 32;
+    }
+    return num_words * sizeof(uint32_t);
+  }
+  
+ private:
+  // Finds the order with the smallest residuals, then the Rice parameter
+  // with the shortest code for them, among the 3 closest to the log2 of their
+  // mean. Returns the length of the code, without the header.
+  static uint32_t Analyze(
+      const int16_t* samples,
+      size_t size,
+      int32_t* order,
+      int32_t* k) {
+    uint32_t sum[3] = { 0, 0, 0 };
+    for (size_t i = 0; i < size; ++i) {
+      for (int32_t o = 0; o < 3; ++o) {
+        sum[o] += SampleCodecZigzag(SampleCodecResidual(samples, i, o));
+      }
+    }
+    *order = sum[1] < sum[0] ? 1 : 0;
+    *order = sum[2] < sum[*order] ? 2 : *order;
+    
+    int32_t estimate = 0;
+    while (estimate < kSampleCodecMaxRiceParameter &&
+           (size << (estimate + 1)) <= sum[*order]) {
+      ++estimate;
+    }
+    uint32_t best_bits = 0xffffffff;
+    *k = 0;
+    for (int32_t p = estimate - 1; p <= estimate + 1; ++p) {
+      if (p < 0 || p > kSampleCodecMaxRiceParameter) {
+        continue;
+      }
+      uint32_t bits = 0;
+      for (size_t i = 0; i < size; ++i) {
+        bits += CodeLength(
+            SampleCodecZigzag(SampleCodecResidual(samples, i, *order)), p);
+      }
+      if (bits < best_bits) {
+        best_bits = bits;
+        *k = p;
+      }
+    }
+    return best_bits;
+  }
+  
+  static inline uint32_t CodeLength(uint32_t u, int32_t k) {
+    uint32_t q = u >> k;
+    return q < kSampleCodecEscape
+        ? q + 1 + k
+        : kSampleCodecEscape + kSampleCodecEscapeBits;
+  }
+  
+  // Writes the num_bits (at most 32) low bits of value, MSB first.
+  inline void Write(uint32_t value, int32_t num_bits) {
+    int32_t free = 32 - num_bits_;
+    if (num_bits < free) {
+      word_ |= value << (free - num_bits);
+      num_bits_ += num_bits;
+    } else {
+      int32_t spill = num_bits - free;
+      *out_++ = word_ | (value >> spill);
+      word_ = spill ? value << (32 - spill) : 0;
+      num_bits_ = spill;
+    }
+  }
+  
+  const int16_t* samples_;
+  size_t size_;
+  size_t position_;
+  
+  uint32_t* out_;
+  uint32_t word_;
+  int32_t num_bits_;
+  
+  DISALLOW_COPY_AND_ASSIGN(SampleEncoder);
+};
+
+class SampleDecoder {
+ public:
+  SampleDecoder() { }
+  ~SampleDecoder() { }
+  
+  // Decodes size samples from at most num_words words of data, and returns
+  // the number of words used; or 0 if the data is truncated or corrupted.
+  size_t Decode(
+      const uint32_t* data,
+      size_t num_words,
+      int16_t* samples,
+      size_t size) {
+    in_ = data;
+    end_ = data + num_words;
+    error_ = false;
+    for (size_t position = 0; position < size && !error_; ) {
+      size_t chunk_size = size - position;
+      if (chunk_size > kSampleCodecChunkSize) {
+        chunk_size = kSampleCodecChunkSize;
+      }
+      DecodeChunk(&samples[position], chunk_size);
+      position += chunk_size;
+    }
+    return error_ ? 0 : in_ - data;
+  }
+  
+ private:
+  void DecodeChunk(int16_t* samples, size_t size) {
+    bits_ = 0;
+    num_bits_ = 0;
+    uint32_t header = Read(kSampleCodecHeaderBits);
+    int32_t method = header >> 4;
+    int32_t k = header & 0xf;
+    if (method == SAMPLE_CODEC_VERBATIM) {
+      for (size_t i = 0; i < size; ++i) {
+        samples[i] = static_cast<int16_t>(Read(16));
+      }
+      return;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      uint32_t q = ReadUnary();
+      uint32_t u = q < kSampleCodecEscape
+          ? (q << k) | (k ? Read(k) : 0)
+          : Read(kSampleCodecEscapeBits);
+      int32_t x = SampleCodecUnzigzag(u);
+      if (method == SAMPLE_CODEC_ORDER_0 || i == 0) {
+      } else if (method == SAMPLE_CODEC_ORDER_1 || i == 1) {
+        x += samples[i - 1];
+      } else {
+        x += 2 * samples[i - 1] - samples[i - 2];
+      }
+      samples[i] = static_cast<int16_t>(x);
+    }
+  }
+  
+  // Reads num_bits (at most 32) bits, MSB first. Words are only fetched when
+  // needed, so that no word past the chunk is read.
+  inline uint32_t Read(int32_t num_bits) {
+    if (num_bits_ < num_bits && !Fetch()) {
+      return 0;
+    }
+    uint32_t value = static_cast<uint32_t>(bits_ >> (64 - num_bits));
+    Skip(num_bits);
+    return value;
+  }
+  
+  // Reads ones up to a zero, or up to the escape code.
+  inline uint32_t ReadUnary() {
+    uint32_t q = 0;
+    while (true) {
+      if (!num_bits_ && !Fetch()) {
+        return 0;
+      }
+      // The bits below the buffered ones are zeros, so that this counts at
+      // most num_bits_ ones.
+      uint32_t ones = __builtin_clzll(~bits_);
+      if (q + ones >= kSampleCodecEscape) {
+        Skip(kSampleCodecEscape - q);
+        return kSampleCodecEscape;
+      } else if (ones < static_cast<uint32_t>(num_bits_)) {
+        Skip(ones + 1);
+        return q + ones;
+      }
+      Skip(ones);
+      q += ones;
+    }
+  }
+  
+  inline void Skip(int32_t num_bits) {
+    bits_ <<= num_bits;
+    num_bits_ -= num_bits;
+  }
+  
+  inline bool Fetch() {
+    if (in_ == end_) {
+      error_ = true;
+      return false;
+    }
+    bits_ |= static_cast<uint64_t>(*in_++) << (32 - num_bits_);
+    num_bits_ += 32;
+    return true;
+  }
+  
+  const uint32_t* in_;
+  const uint32_t* end_;
+  bool error_;
+  uint64_t bits_;
+  int32_t num_bits_;
+  
+  DISALLOW_COPY_AND_ASSIGN(SampleDecoder);
+};
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_SAMPLE_CODEC_H_
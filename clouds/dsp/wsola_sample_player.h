@@ -168,10 +168,12 @@ class WSOLASamplePlayer {
     return num_samples;
   }
   
+  // Returns an estimate of the cost in Cortex-M7 cycles, or 0 when the
+  // correlator is already loaded.
   template<Resolution resolution>
-  void LoadCorrelator(const AudioBuffer<resolution>* buffer) {
+  size_t LoadCorrelator(const AudioBuffer<resolution>* buffer) {
     if (correlator_loaded_) {
-      return;
+      return 0;
     }
     float stride = window_size_ / 2048.0f;
     CONSTRAIN(stride, 1.0f, 2.0f);
@@ -211,6 +213,8 @@ class WSOLASamplePlayer {
         search_target_ - window_size_ + (window_size_ >> 1),
         increment);
     correlator_loaded_ = true;
+    // 3 windows of samples are read, at about 8 cycles per sample.
+    return window_size_ * 3 * num_channels_ * 8;
   }
  private:
   template<Resolution resolution>
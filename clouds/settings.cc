@@ -36,6 +36,25 @@ namespace clouds {
 
 stmlib::Storage<1> storage;
 
+class FlashWriter {
+ public:
+  FlashWriter() { }
+  ~FlashWriter() { }
+  
+  void Init(uint32_t* address) {
+    address_ = address;
+  }
+  
+  inline void Write(uint32_t word) {
+    FLASH_ProgramWord((uint32_t)(address_++), word);
+  }
+  
+ private:
+  uint32_t* address_;
+  
+  DISALLOW_COPY_AND_ASSIGN(FlashWriter);
+};
+
 void Settings::Init() {
   freshly_baked_ = false;
   if (!storage.ParsimoniousLoad(&data_, &version_token_)) {
@@ -70,16 +89,9 @@ void Settings::SaveSampleMemory(
   FLASH_EraseSector(sample_flash_sector(index) * 8, VoltageRange_3);
   
   // Write all data blocks.
-  for (size_t block = 0; block < num_blocks; ++block) {
-    FLASH_ProgramWord((uint32_t)(data++), blocks[block].tag);
-    FLASH_ProgramWord((uint32_t)(data++), blocks[block].size);
-    size_t size = blocks[block].size;
-    const uint32_t* words = (const uint32_t*)(blocks[block].data);
-    while (size >= 4) {
-      FLASH_ProgramWord((uint32_t)(data++), *words++);
-      size -= 4;
-    }
-  }
+  FlashWriter writer;
+  writer.Init(data);
+  WritePersistentBlocks(blocks, num_blocks, &writer);
 }
 
 void Settings::Save() {
@@ -31,6 +31,10 @@
 namespace stmlib {
 
 /* static */
+#ifdef TEST
+thread_local uint32_t Random::rng_state_ = 0x21;
+#else
 uint32_t Random::rng_state_ = 0x21;
+#endif  // TEST
 
 }  // namespace stmlib
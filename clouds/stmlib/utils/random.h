@@ -55,7 +55,12 @@ class Random {
   }
 
  private:
+#ifdef TEST
+  // Host tools may run several processors on different threads.
+  static thread_local uint32_t rng_state_;
+#else
   static uint32_t rng_state_;
+#endif  // TEST
 
   DISALLOW_COPY_AND_ASSIGN(Random);
 };
@@ -88,7 +88,8 @@ void TestDSP() {
   GranularProcessor processor;
   processor.Init(
       &large_buffer[0], sizeof(large_buffer),
-      &small_buffer[0],sizeof(small_buffer));
+      &small_buffer[0],sizeof(small_buffer),
+      kSampleRate);
 
   processor.set_num_channels(2);
   processor.set_low_fidelity(false);
@@ -173,7 +174,8 @@ void TestGrainSize() {
   GranularProcessor processor;
   processor.Init(
       &large_buffer[0], sizeof(large_buffer),
-      &small_buffer[0],sizeof(small_buffer));
+      &small_buffer[0],sizeof(small_buffer),
+      kSampleRate);
 
   processor.set_num_channels(2);
   processor.set_low_fidelity(false);